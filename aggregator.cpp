@@ -0,0 +1,211 @@
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <aggregator.h>
+#include <logger.h>
+#include <sys/time.h>
+
+using namespace std;
+
+/**
+ * Construct an aggregator
+ *
+ * @param window	The size of the tumbling window in milliseconds
+ */
+Aggregator::Aggregator(unsigned long window) : m_window(window ? window : 1), m_latest(0)
+{
+}
+
+/**
+ * Destructor, discard any summaries that have not been collected
+ */
+Aggregator::~Aggregator()
+{
+	for (auto reading : m_closed)
+	{
+		delete reading;
+	}
+}
+
+/**
+ * Add a reading to the current window of its asset. If the reading
+ * belongs to a later window the current window is closed first.
+ *
+ * @param reading	The reading to add
+ * @param mask		Optional mask of the datapoints to aggregate
+ */
+void Aggregator::add(Reading *reading, const ProjectionMask *mask)
+{
+	if (mask && mask->drop)
+	{
+		return;
+	}
+	struct timeval tv;
+	reading->getUserTimestamp(&tv);
+	unsigned long timestamp = (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	unsigned long start = timestamp - (timestamp % m_window);
+	if (timestamp > m_latest)
+	{
+		m_latest = timestamp;
+	}
+
+	const string& assetName = reading->getAssetName();
+	AssetWindow& window = m_assets[assetName];
+	if (window.open && start != window.start)
+	{
+		if (start < window.start)
+		{
+			Logger::getLogger()->debug("Reading of asset %s is older than the current window and has been discarded",
+					assetName.c_str());
+			return;
+		}
+		emit(assetName, window);
+	}
+	if (!window.open)
+	{
+		window.start = start;
+		window.open = true;
+	}
+
+	vector<Datapoint *>& datapoints = reading->getReadingData();
+	for (unsigned int i = 0; i < datapoints.size(); i++)
+	{
+		if (mask && !mask->test(i))
+		{
+			continue;
+		}
+		DatapointValue& dpv = datapoints[i]->getData();
+		double value;
+		switch (dpv.getType())
+		{
+			case DatapointValue::T_INTEGER:
+				value = (double)dpv.toInt();
+				break;
+			case DatapointValue::T_FLOAT:
+				value = dpv.toDouble();
+				break;
+			default:
+				// Only numeric datapoints are aggregated
+				continue;
+		}
+
+		// Datapoints normally appear in the same order in every reading of an asset
+		unsigned int j = i;
+		if (j >= window.names.size() || window.names[j].compare(datapoints[i]->getName()) != 0)
+		{
+			string name = datapoints[i]->getName();
+			for (j = 0; j < window.names.size(); j++)
+			{
+				if (window.names[j].compare(name) == 0)
+					break;
+			}
+			if (j == window.names.size())
+			{
+				Accumulator empty = { 0.0, 0.0, 0.0, 0 };
+				window.names.push_back(name);
+				window.values.push_back(empty);
+			}
+		}
+
+		Accumulator& acc = window.values[j];
+		if (acc.count == 0)
+		{
+			acc.min = value;
+			acc.max = value;
+			acc.sum = value;
+		}
+		else
+		{
+			if (value < acc.min)
+				acc.min = value;
+			if (value > acc.max)
+				acc.max = value;
+			acc.sum += value;
+		}
+		acc.count++;
+	}
+}
+
+/**
+ * Collect the summaries of all the windows that have closed. A window
+ * is closed when a reading for a later window has been added, either
+ * for the same asset or for any other asset.
+ *
+ * @param summaries	Vector to which the summary readings are appended
+ */
+void Aggregator::close(vector<Reading *>& summaries)
+{
+	for (auto& asset : m_assets)
+	{
+		AssetWindow& window = asset.second;
+		if (window.open && window.start + m_window <= m_latest)
+		{
+			emit(asset.first, window);
+		}
+	}
+	summaries.insert(summaries.end(), m_closed.begin(), m_closed.end());
+	m_closed.clear();
+}
+
+/**
+ * Close all of the open windows and collect their summaries, used when
+ * the aggregator is about to be discarded
+ *
+ * @param summaries	Vector to which the summary readings are appended
+ */
+void Aggregator::flush(vector<Reading *>& summaries)
+{
+	for (auto& asset : m_assets)
+	{
+		if (asset.second.open)
+		{
+			emit(asset.first, asset.second);
+		}
+	}
+	summaries.insert(summaries.end(), m_closed.begin(), m_closed.end());
+	m_closed.clear();
+}
+
+/**
+ * Create the summary reading for the window of an asset and reset
+ * the window. The summary carries the start time of the window.
+ *
+ * @param asset		The asset name
+ * @param window	The window to close
+ */
+void Aggregator::emit(const string& asset, AssetWindow& window)
+{
+	vector<Datapoint *> datapoints;
+	for (unsigned int i = 0; i < window.values.size(); i++)
+	{
+		Accumulator& acc = window.values[i];
+		if (acc.count == 0)
+			continue;
+		DatapointValue min(acc.min);
+		datapoints.push_back(new Datapoint(window.names[i] + "_min", min));
+		DatapointValue max(acc.max);
+		datapoints.push_back(new Datapoint(window.names[i] + "_max", max));
+		DatapointValue avg(acc.sum / acc.count);
+		datapoints.push_back(new Datapoint(window.names[i] + "_avg", avg));
+		DatapointValue count((long)acc.count);
+		datapoints.push_back(new Datapoint(window.names[i] + "_count", count));
+		acc.count = 0;
+	}
+	window.open = false;
+
+	if (datapoints.empty())
+	{
+		return;
+	}
+	Reading *summary = new Reading(asset, datapoints);
+	struct timeval tv;
+	tv.tv_sec = window.start / 1000;
+	tv.tv_usec = (window.start % 1000) * 1000;
+	summary->setUserTimestamp(tv);
+	summary->setTimestamp(tv);
+	m_closed.push_back(summary);
+}
@@ -0,0 +1,299 @@
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <compressor.h>
+#include <logger.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+using namespace std;
+
+/**
+ * The size of a dictionary trained from the messages sent and the
+ * maximum amount of sample data collected to train it
+ */
+#define DICTIONARY_SIZE		16384
+#define MAX_SAMPLE_BYTES	(8 * 1024 * 1024)
+
+/**
+ * C Wrapper for the thread that trains a dictionary
+ */
+static void trainThreadWrapper(Compressor *compressor)
+{
+	compressor->train();
+}
+
+/**
+ * Construct a compressor
+ *
+ * @param level		The zstd compression level
+ * @param dictionary	The dictionary file, empty if none is to be loaded
+ * @param trainSamples	The number of messages to train a dictionary from
+ *			if no dictionary file is given, 0 for no dictionary
+ */
+Compressor::Compressor(int level, const string& dictionary, unsigned int trainSamples) :
+	m_valid(false), m_level(level), m_dictionary(dictionary), m_trainRequested(trainSamples),
+	m_dictID(0), m_trainSamples(0), m_trainThread(NULL), m_trained(false), m_cctx(NULL), m_cdict(NULL)
+{
+#ifdef HAVE_ZSTD
+	m_cctx = ZSTD_createCCtx();
+	if (!m_cctx)
+	{
+		Logger::getLogger()->error("Unable to create zstd compression context");
+		return;
+	}
+	m_valid = true;
+	if (!dictionary.empty())
+	{
+		loadDictionary(dictionary);
+	}
+	else
+	{
+		m_trainSamples = trainSamples;
+	}
+#else
+	Logger::getLogger()->error("The plugin has been built without zstd support, messages will not be compressed");
+#endif
+}
+
+/**
+ * Destructor
+ */
+Compressor::~Compressor()
+{
+	if (m_trainThread)
+	{
+		m_trainThread->join();
+		delete m_trainThread;
+	}
+#ifdef HAVE_ZSTD
+	if (m_cdict)
+		ZSTD_freeCDict((ZSTD_CDict *)m_cdict);
+	if (m_cctx)
+		ZSTD_freeCCtx((ZSTD_CCtx *)m_cctx);
+#endif
+}
+
+/**
+ * Return the directory in which dictionaries are stored
+ *
+ * @return	The dictionary directory
+ */
+string Compressor::dictionaryLocation()
+{
+	char *env = getenv("FLEDGE_DATA");
+	if (env)
+	{
+		return string(env) + "/etc/kafka/";
+	}
+	env = getenv("FLEDGE_ROOT");
+	if (env)
+	{
+		return string(env) + "/data/etc/kafka/";
+	}
+	return "/usr/local/fledge/data/etc/kafka/";
+}
+
+/**
+ * Load a dictionary from a file. Relative names are found in the
+ * dictionary directory.
+ *
+ * @param dictionary	The dictionary file name
+ * @return	True if the dictionary was loaded
+ */
+bool Compressor::loadDictionary(const string& dictionary)
+{
+	string path = dictionary[0] == '/' ? dictionary : dictionaryLocation() + dictionary;
+	ifstream file(path.c_str(), ios::binary);
+	if (!file)
+	{
+		Logger::getLogger()->error("Unable to open zstd dictionary %s, messages will be compressed without a dictionary",
+				path.c_str());
+		return false;
+	}
+	string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	if (!setDictionary(content.data(), content.size()))
+	{
+		return false;
+	}
+	Logger::getLogger()->info("Loaded zstd dictionary %u from %s", m_dictID, path.c_str());
+	return true;
+}
+
+/**
+ * Use a dictionary for all subsequent messages
+ *
+ * @param dictionary	The dictionary content
+ * @param size		The size of the dictionary
+ * @return	True if the dictionary is valid
+ */
+bool Compressor::setDictionary(const char *dictionary, size_t size)
+{
+#ifdef HAVE_ZSTD
+	ZSTD_CDict *cdict = ZSTD_createCDict(dictionary, size, m_level);
+	if (!cdict)
+	{
+		Logger::getLogger()->error("Invalid zstd dictionary, messages will be compressed without a dictionary");
+		return false;
+	}
+	if (m_cdict)
+		ZSTD_freeCDict((ZSTD_CDict *)m_cdict);
+	m_cdict = cdict;
+	m_dictID = ZSTD_getDictID_fromCDict(cdict);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Train a dictionary from the sample messages collected. Run on a thread
+ * of its own, the dictionary is picked up by the next call to compress.
+ * The dictionary is written to the dictionary directory, named by its ID,
+ * so that it can be distributed to the consumers. It is not used if it
+ * could not be saved, as consumers would be unable to decompress messages.
+ */
+void Compressor::train()
+{
+#ifdef HAVE_ZSTD
+	vector<char> dictionary(DICTIONARY_SIZE);
+	size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(),
+				m_samples.data(), m_sampleSizes.data(), m_sampleSizes.size());
+	string path;
+	if (ZDICT_isError(size))
+	{
+		Logger::getLogger()->warn("Unable to train a zstd dictionary from %d messages: %s",
+				(int)m_sampleSizes.size(), ZDICT_getErrorName(size));
+	}
+	else if (saveDictionary(dictionary.data(), size, path))
+	{
+		Logger::getLogger()->info("Trained zstd dictionary %u from %d messages, saved as %s",
+				ZDICT_getDictID(dictionary.data(), size), (int)m_sampleSizes.size(), path.c_str());
+		dictionary.resize(size);
+		m_trainedDictionary.swap(dictionary);
+	}
+#endif
+	m_samples.clear();
+	m_samples.shrink_to_fit();
+	m_sampleSizes.clear();
+	m_sampleSizes.shrink_to_fit();
+	m_trained = true;
+}
+
+/**
+ * Write a trained dictionary to the dictionary directory, creating
+ * the directory if required
+ *
+ * @param dictionary	The dictionary content
+ * @param size		The size of the dictionary
+ * @param path		Returns the file the dictionary was written to
+ * @return	True if the dictionary was written
+ */
+bool Compressor::saveDictionary(const char *dictionary, size_t size, string& path)
+{
+#ifdef HAVE_ZSTD
+	string location = dictionaryLocation();
+	for (size_t pos = location.find('/', 1); pos != string::npos; pos = location.find('/', pos + 1))
+	{
+		string directory = location.substr(0, pos);
+		if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+		{
+			Logger::getLogger()->error("Unable to create the zstd dictionary directory %s: %s, messages will be compressed without a dictionary",
+					directory.c_str(), strerror(errno));
+			return false;
+		}
+	}
+	ostringstream name;
+	name << location << "kafka-" << ZDICT_getDictID(dictionary, size) << ".dict";
+	path = name.str();
+	ofstream file(path.c_str(), ios::binary);
+	if (file)
+	{
+		file.write(dictionary, size);
+		file.close();
+	}
+	if (!file)
+	{
+		Logger::getLogger()->error("Unable to save the zstd dictionary as %s, messages will be compressed without a dictionary",
+				path.c_str());
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Compress a message. The returned data remains valid until the
+ * next call.
+ *
+ * @param message	The message to compress
+ * @param data		Returns the compressed message
+ * @param length	Returns the length of the compressed message
+ * @return	True if the message was compressed
+ */
+bool Compressor::compress(const string& message, const char **data, size_t *length)
+{
+#ifdef HAVE_ZSTD
+	if (m_trained)
+	{
+		m_trainThread->join();
+		delete m_trainThread;
+		m_trainThread = NULL;
+		m_trained = false;
+		if (!m_trainedDictionary.empty())
+		{
+			setDictionary(m_trainedDictionary.data(), m_trainedDictionary.size());
+			m_trainedDictionary.clear();
+			m_trainedDictionary.shrink_to_fit();
+		}
+	}
+	if (m_trainSamples)
+	{
+		m_samples.append(message);
+		m_sampleSizes.push_back(message.size());
+		if (m_sampleSizes.size() >= m_trainSamples || m_samples.size() >= MAX_SAMPLE_BYTES)
+		{
+			// The samples are left to the training thread
+			m_trainSamples = 0;
+			m_trainThread = new thread(trainThreadWrapper, this);
+		}
+	}
+
+	m_buffer.resize(ZSTD_compressBound(message.size()));
+	size_t size;
+	if (m_cdict)
+	{
+		size = ZSTD_compress_usingCDict((ZSTD_CCtx *)m_cctx, m_buffer.data(), m_buffer.size(),
+				message.data(), message.size(), (ZSTD_CDict *)m_cdict);
+	}
+	else
+	{
+		size = ZSTD_compressCCtx((ZSTD_CCtx *)m_cctx, m_buffer.data(), m_buffer.size(),
+				message.data(), message.size(), m_level);
+	}
+	if (ZSTD_isError(size))
+	{
+		Logger::getLogger()->error("zstd compression failed: %s", ZSTD_getErrorName(size));
+		return false;
+	}
+	*data = m_buffer.data();
+	*length = size;
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,214 @@
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <deadband.h>
+#include <math.h>
+#include <functional>
+
+using namespace std;
+
+/**
+ * Construct a report by exception filter
+ *
+ * @param mode		Whether the deadband is an absolute value or a percentage
+ * @param deadband	The deadband value
+ * @param heartbeat	The maximum interval in seconds between sending a datapoint
+ */
+Deadband::Deadband(Mode mode, double deadband, unsigned long heartbeat) :
+	m_mode(mode), m_deadband(fabs(deadband)), m_heartbeat(heartbeat), m_sequence(0)
+{
+}
+
+/**
+ * Determine if a datapoint should be reported. The value is compared
+ * with the latest value reported for the datapoint, whether or not it
+ * has been delivered yet, so that readings within a single block are
+ * compared with each other. A reported value is recorded as pending
+ * and committed once the message that contains it has been delivered.
+ *
+ * @param asset		The asset name of the reading
+ * @param index		The position of the datapoint within the reading
+ * @param datapoint	The datapoint
+ * @param timestamp	The user timestamp of the reading in seconds
+ * @return	True if the datapoint should be sent
+ */
+bool Deadband::report(const string& asset, unsigned int index, Datapoint *datapoint, unsigned long timestamp)
+{
+	DeadbandValue current;
+	current.name = datapoint->getName();
+	current.sent = timestamp;
+	DatapointValue& dpv = datapoint->getData();
+	switch (dpv.getType())
+	{
+		case DatapointValue::T_INTEGER:
+			current.numeric = true;
+			current.value = (double)dpv.toInt();
+			current.hash = 0;
+			break;
+		case DatapointValue::T_FLOAT:
+			current.numeric = true;
+			current.value = dpv.toDouble();
+			current.hash = 0;
+			break;
+		default:
+			current.numeric = false;
+			current.value = 0.0;
+			current.hash = hash<string>()(dpv.toString());
+			break;
+	}
+
+	vector<DeadbandEntry>& entries = m_assets[asset];
+	DeadbandEntry *entry = find(entries, index, current.name);
+	if (!entry)
+	{
+		entries.push_back(DeadbandEntry());
+		entry = &entries.back();
+		entry->name = current.name;
+	}
+	else if (entry->isReported)
+	{
+		const DeadbandValue& last = entry->reported;
+		if (timestamp < last.sent + m_heartbeat && !outsideDeadband(last, current))
+		{
+			return false;
+		}
+	}
+
+	current.sequence = ++m_sequence;
+	entry->reported = current;
+	entry->isReported = true;
+	if (m_pending.empty())
+	{
+		m_pendingAsset = asset;
+	}
+	m_pending.push_back(current);
+	return true;
+}
+
+/**
+ * Collect the values reported for the message about to be produced
+ *
+ * @return	The values to commit once the message is delivered, NULL if none
+ */
+DeadbandUpdate *Deadband::pending()
+{
+	if (m_pending.empty())
+	{
+		return NULL;
+	}
+	DeadbandUpdate *update = new DeadbandUpdate;
+	update->asset = m_pendingAsset;
+	update->values.swap(m_pending);
+	return update;
+}
+
+/**
+ * Record the values of a delivered message as the committed values.
+ * Deliveries of earlier messages that arrive late do not replace the
+ * values of a later message.
+ *
+ * @param update	The values of the message
+ */
+void Deadband::commit(const DeadbandUpdate *update)
+{
+	vector<DeadbandEntry>& entries = m_assets[update->asset];
+	for (unsigned int i = 0; i < update->values.size(); i++)
+	{
+		const DeadbandValue& value = update->values[i];
+		DeadbandEntry *entry = find(entries, i, value.name);
+		if (!entry)
+		{
+			entries.push_back(DeadbandEntry());
+			entry = &entries.back();
+			entry->name = value.name;
+		}
+		if (!entry->isCommitted || entry->committed.sequence < value.sequence)
+		{
+			entry->committed = value;
+			entry->isCommitted = true;
+		}
+		if (!entry->isReported || entry->reported.sequence < value.sequence)
+		{
+			entry->reported = value;
+			entry->isReported = true;
+		}
+	}
+}
+
+/**
+ * Revert the values of a message that could not be delivered to the
+ * committed values, so that the next value of each datapoint is
+ * compared with the value the consumers last received
+ *
+ * @param update	The values of the message
+ */
+void Deadband::rollback(const DeadbandUpdate *update)
+{
+	auto it = m_assets.find(update->asset);
+	if (it == m_assets.end())
+	{
+		return;
+	}
+	for (unsigned int i = 0; i < update->values.size(); i++)
+	{
+		const DeadbandValue& value = update->values[i];
+		DeadbandEntry *entry = find(it->second, i, value.name);
+		if (entry && entry->isReported && entry->reported.sequence >= value.sequence)
+		{
+			entry->reported = entry->committed;
+			entry->isReported = entry->isCommitted;
+		}
+	}
+}
+
+/**
+ * Find the state of a datapoint of an asset
+ *
+ * @param entries	The datapoints of the asset
+ * @param index		The expected position of the datapoint
+ * @param name		The name of the datapoint
+ * @return	The state of the datapoint or NULL if it has not been seen
+ */
+DeadbandEntry *Deadband::find(vector<DeadbandEntry>& entries, unsigned int index, const string& name)
+{
+	// Datapoints normally appear in the same order in every reading of an asset
+	if (index < entries.size() && entries[index].name.compare(name) == 0)
+	{
+		return &entries[index];
+	}
+	for (auto& entry : entries)
+	{
+		if (entry.name.compare(name) == 0)
+			return &entry;
+	}
+	return NULL;
+}
+
+/**
+ * Compare a value with the last value reported
+ *
+ * @param last		The last value reported
+ * @param current	The new value
+ * @return	True if the new value should be sent
+ */
+bool Deadband::outsideDeadband(const DeadbandValue& last, const DeadbandValue& current)
+{
+	if (last.numeric != current.numeric)
+	{
+		return true;
+	}
+	if (!current.numeric)
+	{
+		return last.hash != current.hash;
+	}
+	double delta = fabs(current.value - last.value);
+	if (m_mode == DEADBAND_PERCENT)
+	{
+		return delta > fabs(last.value) * m_deadband / 100.0;
+	}
+	return delta > m_deadband;
+}
@@ -0,0 +1,65 @@
+#ifndef _AGGREGATOR_H
+#define _AGGREGATOR_H
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <reading.h>
+#include <projection.h>
+
+/**
+ * Tumbling window aggregation of numeric datapoints. Readings are added
+ * to a window per asset and, once the window has closed, a summary reading
+ * with the minimum, maximum, average and count of each datapoint is created.
+ */
+class Aggregator
+{
+	public:
+		Aggregator(unsigned long window);
+		~Aggregator();
+		unsigned long	getWindow() { return m_window; };
+		void		add(Reading *reading, const ProjectionMask *mask = NULL);
+		void		close(std::vector<Reading *>& summaries);
+		void		flush(std::vector<Reading *>& summaries);
+
+	private:
+		/**
+		 * The running summary of a single datapoint
+		 */
+		class Accumulator
+		{
+			public:
+				double		min;
+				double		max;
+				double		sum;
+				unsigned long	count;
+		};
+		/**
+		 * The current window of an asset. The accumulators are held
+		 * contiguously and in the same order as the datapoint names
+		 * so that adding a reading walks a single array.
+		 */
+		class AssetWindow
+		{
+			public:
+				AssetWindow() : start(0), open(false) {};
+				unsigned long			start;
+				bool				open;
+				std::vector<Accumulator>	values;
+				std::vector<std::string>	names;
+		};
+		void		emit(const std::string& asset, AssetWindow& window);
+		unsigned long	m_window;
+		unsigned long	m_latest;
+		std::unordered_map<std::string, AssetWindow>
+				m_assets;
+		std::vector<Reading *>
+				m_closed;
+};
+#endif
@@ -0,0 +1,64 @@
+#ifndef _COMPRESSOR_H
+#define _COMPRESSOR_H
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+/**
+ * Compression of individual messages using zstd with an optional
+ * dictionary. The dictionary is either loaded from a file created by
+ * the kafka_dictionary tool or trained on a sample of the first
+ * messages sent. Training runs on a thread of its own and the trained
+ * dictionary is only used once it has been saved for the consumers.
+ * Until a dictionary is available messages are compressed without one
+ * and reported with a dictionary ID of 0.
+ */
+class Compressor
+{
+	public:
+		Compressor(int level, const std::string& dictionary, unsigned int trainSamples);
+		~Compressor();
+		bool		isValid() { return m_valid; };
+		bool		matches(int level, const std::string& dictionary, unsigned int trainSamples)
+				{
+					return level == m_level && dictionary.compare(m_dictionary) == 0
+						&& trainSamples == m_trainRequested;
+				};
+		unsigned int	getDictionaryID() { return m_dictID; };
+		bool		compress(const std::string& message, const char **data, size_t *length);
+		static std::string
+				dictionaryLocation();
+		void		train();
+
+	private:
+		bool		loadDictionary(const std::string& dictionary);
+		bool		saveDictionary(const char *dictionary, size_t size, std::string& path);
+		bool		setDictionary(const char *dictionary, size_t size);
+		bool		m_valid;
+		int		m_level;
+		std::string	m_dictionary;
+		unsigned int	m_trainRequested;
+		unsigned int	m_dictID;
+		unsigned int	m_trainSamples;
+		std::string	m_samples;
+		std::vector<size_t>
+				m_sampleSizes;
+		std::vector<char>
+				m_buffer;
+		std::thread	*m_trainThread;
+		std::atomic<bool>
+				m_trained;
+		std::vector<char>
+				m_trainedDictionary;
+		void		*m_cctx;
+		void		*m_cdict;
+};
+#endif
@@ -0,0 +1,94 @@
+#ifndef _DEADBAND_H
+#define _DEADBAND_H
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <math.h>
+#include <reading.h>
+
+/**
+ * A value reported for a datapoint. Numeric values are held as a
+ * double, all other types as a hash of the value.
+ */
+class DeadbandValue
+{
+	public:
+		std::string	name;
+		bool		numeric;
+		double		value;
+		size_t		hash;
+		unsigned long	sent;
+		unsigned long	sequence;
+};
+
+/**
+ * The state of a datapoint. New values are compared with the latest
+ * value reported, which becomes the committed value once the message
+ * that contains it has been delivered. If the delivery fails the
+ * reported value reverts to the committed value.
+ */
+class DeadbandEntry
+{
+	public:
+		DeadbandEntry() : isReported(false), isCommitted(false) {};
+		std::string	name;
+		DeadbandValue	reported;
+		DeadbandValue	committed;
+		bool		isReported;
+		bool		isCommitted;
+};
+
+/**
+ * The values of a reading that become the last values sent once the
+ * message that contains them has been delivered
+ */
+class DeadbandUpdate
+{
+	public:
+		std::string			asset;
+		std::vector<DeadbandValue>	values;
+};
+
+/**
+ * Report by exception filter. Keeps the last value sent for each
+ * datapoint of each asset and suppresses datapoints whose value has
+ * not moved outside of the deadband since it was last sent. A datapoint
+ * is always sent if it has not been sent within the heartbeat interval.
+ */
+class Deadband
+{
+	public:
+		enum Mode { DEADBAND_ABSOLUTE, DEADBAND_PERCENT };
+		Deadband(Mode mode, double deadband, unsigned long heartbeat);
+		bool		matches(Mode mode, double deadband, unsigned long heartbeat)
+				{
+					return mode == m_mode && fabs(deadband) == m_deadband && heartbeat == m_heartbeat;
+				};
+		bool		report(const std::string& asset, unsigned int index,
+					Datapoint *datapoint, unsigned long timestamp);
+		DeadbandUpdate	*pending();
+		void		commit(const DeadbandUpdate *update);
+		void		rollback(const DeadbandUpdate *update);
+
+	private:
+		DeadbandEntry	*find(std::vector<DeadbandEntry>& entries, unsigned int index,
+					const std::string& name);
+		bool		outsideDeadband(const DeadbandValue& last, const DeadbandValue& current);
+		Mode		m_mode;
+		double		m_deadband;
+		unsigned long	m_heartbeat;
+		unsigned long	m_sequence;
+		std::unordered_map<std::string, std::vector<DeadbandEntry> >
+				m_assets;
+		std::string	m_pendingAsset;
+		std::vector<DeadbandValue>
+				m_pending;
+};
+#endif
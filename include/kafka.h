@@ -11,10 +11,55 @@
  */
 #include <string>
 #include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
 #include <vector>
+#include <map>
 #include <reading.h>
 #include <rdkafka.h>
 #include <config_category.h>
+#include <deadband.h>
+#include <aggregator.h>
+#include <projection.h>
+#include <latency.h>
+#include <compressor.h>
+#include <snapshot.h>
+
+class Kafka;
+
+/**
+ * A Kafka cluster that data is sent to, with its own producer. The
+ * cluster is the opaque of the callbacks of the producer.
+ */
+class KafkaCluster
+{
+	public:
+		KafkaCluster(Kafka *kafka) : kafka(kafka), rk(NULL), rkt(NULL), up(true), inflight(0), skipped(0) {};
+		Kafka			*kafka;
+		std::string		brokers;
+		rd_kafka_t		*rk;
+		rd_kafka_topic_t	*rkt;
+		std::atomic<bool>	up;
+		std::atomic<long>	inflight;
+		unsigned long		skipped;
+		std::chrono::steady_clock::time_point
+					lastSkippedReport;
+};
+
+/**
+ * The state of a message produced to Kafka that is returned with its
+ * delivery report. Messages that need no state have no KafkaMessage.
+ */
+class KafkaMessage
+{
+	public:
+		KafkaMessage() : latency(NULL), deadband(NULL), summary(0), counted(true) {};
+		LatencyRecord		*latency;
+		DeadbandUpdate		*deadband;
+		unsigned long		summary;
+		bool			counted;
+};
 
 /**
  * A wrapper class for a simple producer model for Kafka using the librdkafka library
@@ -22,29 +67,133 @@
 class Kafka
 {
 	public:
+		/**
+		 * The readiness of the producer connection
+		 */
+		enum ConnectionState {
+			STATE_CONNECTING,	// Warm up in progress
+			STATE_READY,		// Brokers and topic metadata retrieved
+			STATE_UNAVAILABLE	// Warm up timed out
+		};
+		/**
+		 * How multiple Kafka clusters are used
+		 */
+		enum ClusterMode {
+			CLUSTER_SINGLE,		// Only the primary cluster
+			CLUSTER_FAILOVER,	// Send to the first available cluster
+			CLUSTER_FANOUT		// Send to all clusters
+		};
+		/**
+		 * The outcome of producing a message
+		 */
+		enum ProduceStatus {
+			PRODUCE_OK,		// Queued for delivery
+			PRODUCE_LIMITED,	// No room within the in-flight limit or the queue
+			PRODUCE_FAILED		// Rejected by the Kafka library
+		};
 		Kafka(ConfigCategory*& configData );
 		~Kafka();
-		uint32_t		send(const std::vector<Reading *> readings);
+		uint32_t		send(const std::vector<Reading *>& readings);
 		void			pollThread();
+		void			warmupThread();
+		void			replaceThread(std::vector<KafkaCluster *> clusters, std::string topic,
+						ClusterMode mode, std::string signature);
+		void			drainThread(std::vector<KafkaCluster *> clusters);
 		void			sendJSONObjects(bool arg) { m_objects = arg; };
 		void			connect();
+		void			reconfigure(ConfigCategory*& configData);
+		inline bool		isActive(const rd_kafka_t *rk) { return rk == m_rk; };
 		inline void		success() { m_sent++; };
 		inline void		setErrorStatus(bool isError) { m_error = isError; };
+		void			delivered(KafkaMessage *message, bool success);
+		inline void		released(KafkaCluster *cluster, size_t length)
+					{ cluster->inflight -= length; m_inflight -= length; };
+		void			skipped(KafkaCluster *cluster);
 		static void 		logCallback(const rd_kafka_t *rk, int level, const char *facility, const char *buf);
 		
 	private:
+		void			applyConfig(ConfigCategory*& configData);
+		void			applyLiveConfig(ConfigCategory*& configData);
+		void			applyClusterConfig(ConfigCategory*& configData);
+		ConfigCategory		*profileConfig(ConfigCategory*& configData, const rapidjson::Value& profile);
+		bool			createClusters(const std::string& topic, std::vector<KafkaCluster *>& clusters,
+						ClusterMode mode);
+		bool			createProducer(const std::string& topic, KafkaCluster *cluster);
+		bool			warmup(rd_kafka_t *rk, rd_kafka_topic_t *rkt, long timeout);
+		void			stopWarmup();
+		void			closeProducer(KafkaCluster *cluster,
+						std::chrono::steady_clock::time_point deadline);
+		void			checkClusters();
+		void			activate(unsigned int index);
+		ProduceStatus		sendReading(Reading *reading, const ProjectionMask *mask, bool isReading,
+						unsigned long summary = 0);
+		void			queueSummaries(std::vector<Reading *>& summaries);
+		bool			sendSummaries();
+		void			summaryDelivered(unsigned long id, bool success);
+		uint32_t		sendSnapshot(const std::vector<Reading *>& readings);
+		ProduceStatus		produce(const std::string& message, void *opaque, const std::string *key = NULL);
+		ProduceStatus		produceTo(KafkaCluster *cluster, const char *data, size_t length,
+						bool compressed, void *opaque, const std::string *key, bool wait);
+		bool			waitForCapacity(size_t length);
+		void			reportMemory();
+		std::string		connectionSignature(ConfigCategory*& configData);
 		void			applyConfig_Basic(ConfigCategory*& configData);
 		void			applyConfig_SASL_PLAINTEXT(ConfigCategory*& configData, const std::string& kafkaSecurityProtocol);
 		void			applyConfig_SSL(ConfigCategory*& configData, const std::string& kafkaSecurityProtocol);
 		std::string		certificateStoreLocation();
-		std::string		quote(const std::string& orig);
+		void			quote(std::string& rval, const std::string& orig);
 		volatile bool		m_running;
+		std::string		m_serviceName;
 		std::string		m_topic;
 		std::thread		*m_thread;
-		rd_kafka_t		*m_rk;
+		std::thread		*m_drainThread;
+		std::thread		*m_warmupThread;
+		std::atomic<bool>	m_cancelWarmup;
+		std::atomic<bool>	m_warmupDone;
+		std::atomic<ConnectionState>	m_state;
+		std::mutex		m_mutex;
+		std::string		m_connectionSignature;
+		std::atomic<rd_kafka_t *>	m_rk;
 		rd_kafka_topic_t	*m_rkt;
 		rd_kafka_conf_t		*m_conf;
+		std::vector<rd_kafka_conf_t *>
+					m_profileConfs;
+		std::vector<KafkaCluster *>
+					m_clusters;
+		unsigned int		m_active;
+		ClusterMode		m_clusterMode;
+		unsigned long		m_failbackInterval;
+		std::chrono::steady_clock::time_point
+					m_lastHealthCheck;
 		bool			m_objects;
+		Deadband		*m_deadband;
+		Aggregator		*m_aggregator;
+		Projection		*m_projection;
+		bool			m_traceLatency;
+		LatencyTracker		m_latency;
+		Compressor		*m_compressor;
+		StatisticsSnapshot	*m_snapshot;
+		std::string		m_snapshotKey;
+		std::string		m_payload;
+		long			m_maxInflight;
+		std::atomic<long>	m_inflight;
+		long			m_peakInflight;
+		unsigned int		m_trimmed;
+		std::chrono::steady_clock::time_point
+					m_lastStatistics;
+		/**
+		 * An aggregated summary that is kept until its delivery
+		 * has been acknowledged
+		 */
+		class Summary
+		{
+			public:
+				Reading		*reading;
+				bool		inflight;
+		};
+		std::map<unsigned long, Summary>
+					m_summaries;
+		unsigned long		m_summaryId;
 		bool			m_error;
 		int			m_sent;
 };
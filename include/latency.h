@@ -0,0 +1,99 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <stdint.h>
+#include <reading.h>
+
+/**
+ * Asset identifier used for messages that are not readings
+ */
+#define LATENCY_NO_ASSET	0xffffffff
+
+/**
+ * The record attached to each message produced to Kafka and returned
+ * in the delivery report. Times are in microseconds since the epoch.
+ */
+class LatencyRecord
+{
+	public:
+		uint64_t	readingTime;
+		uint64_t	enqueueTime;
+		uint32_t	asset;
+};
+
+/**
+ * A log linear histogram of latencies in microseconds. Each power of
+ * two is divided into eight buckets, giving a precision of better than
+ * 12.5% across the full range in a fixed amount of memory.
+ */
+class LatencyHistogram
+{
+	public:
+		LatencyHistogram() { reset(); };
+		void		record(uint64_t value);
+		uint64_t	percentile(double percent) const;
+		uint64_t	getCount() const { return m_count; };
+		uint64_t	getMax() const { return m_max; };
+		void		reset();
+
+	private:
+		static const int	SUB_BITS = 3;
+		static const int	MAX_BITS = 40;
+		static const int	BUCKETS = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+		uint32_t	m_buckets[BUCKETS];
+		uint64_t	m_count;
+		uint64_t	m_max;
+};
+
+/**
+ * Collects the delivery latency of the messages sent to Kafka for
+ * each asset and periodically reports the slowest assets.
+ */
+class LatencyTracker
+{
+	public:
+		LatencyTracker();
+		void		configure(unsigned long interval, unsigned int topN, const std::string& assetName);
+		LatencyRecord	*createRecord(Reading *reading);
+		LatencyRecord	*createRecord();
+		void		delivered(LatencyRecord *record, bool success);
+		bool		reportDue();
+		void		report(std::vector<Reading *>& readings);
+
+	private:
+		/**
+		 * The latencies of a single asset, from the reading timestamp to
+		 * the message being queued, from being queued to the broker
+		 * acknowledging it and the total of the two
+		 */
+		class AssetLatency
+		{
+			public:
+				std::string		name;
+				LatencyHistogram	enqueue;
+				LatencyHistogram	ack;
+				LatencyHistogram	total;
+		};
+		std::mutex	m_mutex;
+		std::unordered_map<std::string, uint32_t>
+				m_ids;
+		std::vector<AssetLatency>
+				m_assets;
+		unsigned long	m_interval;
+		unsigned int	m_topN;
+		std::string	m_assetName;
+		std::chrono::steady_clock::time_point
+				m_lastReport;
+};
+#endif
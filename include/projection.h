@@ -0,0 +1,73 @@
+#ifndef _PROJECTION_H
+#define _PROJECTION_H
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <string>
+#include <vector>
+#include <deque>
+#include <regex>
+#include <unordered_set>
+#include <unordered_map>
+#include <stdint.h>
+#include <reading.h>
+
+/**
+ * The datapoints of a reading that should be sent, one bit per
+ * datapoint position
+ */
+class ProjectionMask
+{
+	public:
+		ProjectionMask() : drop(false), size(0), layout(0) {};
+		bool		test(unsigned int index) const
+				{
+					return (bits[index >> 6] >> (index & 63)) & 1;
+				};
+		bool			drop;
+		unsigned int		size;
+		uint64_t		layout;
+		std::vector<uint64_t>	bits;
+};
+
+/**
+ * Asset and datapoint selection. The rules are matched against an
+ * asset the first time a reading of a given shape, the asset name and
+ * the sequence of datapoint names, is seen. The resulting mask is cached
+ * so that subsequent readings of that shape are filtered by bit tests,
+ * at the cost of hashing the datapoint names to identify the shape.
+ */
+class Projection
+{
+	public:
+		Projection(const std::string& rules);
+		bool		hasRules() { return !m_rules.empty(); };
+		const ProjectionMask
+				*getMask(Reading *reading);
+
+	private:
+		/**
+		 * A rule that includes or excludes datapoints of the assets
+		 * whose name matches the asset pattern. A rule with no
+		 * datapoints applies to the whole asset.
+		 */
+		class Rule
+		{
+			public:
+				std::regex				asset;
+				bool					include;
+				std::unordered_set<std::string>		datapoints;
+		};
+		void		compile(Reading *reading, ProjectionMask& mask);
+		static uint64_t	layout(const std::vector<Datapoint *>& datapoints);
+		std::vector<Rule>
+				m_rules;
+		bool		m_selectAssets;
+		std::unordered_map<std::string, std::deque<ProjectionMask> >
+				m_masks;
+};
+#endif
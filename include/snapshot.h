@@ -0,0 +1,41 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <string>
+#include <map>
+
+/**
+ * The values of the statistics sent as a single snapshot message. A
+ * full snapshot contains every statistic seen, a delta snapshot only
+ * those that have changed since the previous snapshot was delivered.
+ * Values are held in their encoded JSON form.
+ */
+class StatisticsSnapshot
+{
+	public:
+		StatisticsSnapshot(bool delta, unsigned int fullInterval);
+		bool		matches(bool delta, unsigned int fullInterval)
+				{
+					return delta == m_delta && fullInterval == m_fullInterval;
+				};
+		void		set(const std::string& name, const std::string& value);
+		bool		changes(std::map<std::string, std::string>& values);
+		void		commit();
+		void		reset();
+
+	private:
+		bool		m_delta;
+		unsigned int	m_fullInterval;
+		unsigned long	m_count;
+		std::map<std::string, std::string>
+				m_current;
+		std::map<std::string, std::string>
+				m_previous;
+};
+#endif
@@ -13,18 +13,163 @@
 #include <errno.h>
 #include <string.h>
 #include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
 #include <syslog.h>
+#include <chrono>
+#include <sys/resource.h>
 
 using namespace	std;
 using namespace rapidjson;
 
+/**
+ * Time in milliseconds to allow a replaced producer to deliver any
+ * outstanding messages before it is destroyed
+ */
+#define DRAIN_TIMEOUT	10000
+
+/**
+ * The interval in milliseconds between serving the delivery reports
+ * of a replaced producer
+ */
+#define DRAIN_POLL	10
+
+/**
+ * Time in milliseconds to wait for the delivery reports of the messages
+ * purged from a producer that is being closed
+ */
+#define PURGE_TIMEOUT	1000
+
+/**
+ * Total time in milliseconds to spend establishing the connection
+ * before the first send, and the timeout of each metadata request
+ */
+#define WARMUP_TIMEOUT		30000
+#define METADATA_TIMEOUT	2000
+
+/**
+ * The timeout in milliseconds of the check that the primary cluster
+ * is available again after a failover
+ */
+#define HEALTH_CHECK_TIMEOUT	500
+
+/**
+ * The time in milliseconds to wait for in-flight data to be acknowledged
+ * when the in-flight limit is reached before the rest of the readings
+ * are left to a later send, and the interval between polls while waiting
+ */
+#define INFLIGHT_WAIT		5000
+#define INFLIGHT_POLL		100
+
+/**
+ * The size of the internal queue of the Kafka library as a multiple of
+ * the in-flight limit. The limit is enforced by the plugin, the headroom
+ * stops the library rejecting a message the plugin has allowed.
+ */
+#define QUEUE_HEADROOM		2
+
+/**
+ * The largest payload buffer kept between calls to send
+ */
+#define MAX_RETAINED_PAYLOAD	65536
+
+/**
+ * The interval in seconds between reporting the memory statistics
+ */
+#define STATISTICS_INTERVAL	60
+
+/**
+ * The minimum interval in seconds between reports of the messages
+ * that could not be sent to a cluster
+ */
+#define SKIPPED_INTERVAL	60
+
+/**
+ * The maximum number of aggregated summary readings held while
+ * they can not be delivered
+ */
+#define MAX_PENDING_SUMMARIES	10000
 
 /**
- * Callback for asynchronous producer results.
+ * Configuration items that require a new producer instance when they change.
+ * Any other item may be applied to the running producer.
+ */
+static const char *connectionItems[] = {
+	"brokers",
+	"compression",
+	"KafkaSecurityProtocol",
+	"KafkaSASLMechanism",
+	"KafkaUserID",
+	"KafkaPassword",
+	"SSL_CA_File",
+	"SSL_CERT",
+	"SSL_Keyfile",
+	"SSL_Password",
+	"maxInflight",
+	NULL
+};
+
+/**
+ * Configuration items that define the set of clusters, these also
+ * require new producers when they change
+ */
+static const char *clusterItems[] = {
+	"clusterMode",
+	"clusters",
+	"clusterPassword",
+	"clusterSSLPassword",
+	NULL
+};
+
+/**
+ * The secrets of the additional clusters. These are held in password
+ * items rather than in the cluster profiles, which are stored and shown
+ * in plain text.
+ */
+static const char *clusterSecrets[][2] = {
+	{ "KafkaPassword", "clusterPassword" },
+	{ "SSL_Password", "clusterSSLPassword" },
+	{ NULL, NULL }
+};
+
+/**
+ * Return the cluster mode of the configuration
+ *
+ * @param configData	plugin configuration data
+ * @return	The cluster mode
+ */
+static Kafka::ClusterMode clusterMode(ConfigCategory*& configData)
+{
+	string mode = configData->itemExists("clusterMode") ? configData->getValue("clusterMode") : "Single";
+	if (mode.compare("Failover") == 0)
+		return Kafka::CLUSTER_FAILOVER;
+	if (mode.compare("Fan-out") == 0)
+		return Kafka::CLUSTER_FANOUT;
+	return Kafka::CLUSTER_SINGLE;
+}
+
+
+/**
+ * Callback for asynchronous producer results. Delivery reports are
+ * always served with the send lock held.
  */
 static void dr_msg_cb(rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void *opaque)
 {
-        if (rkmessage->err)
+	KafkaCluster *cluster = (KafkaCluster *)opaque;
+	Kafka *kafka = cluster->kafka;
+	KafkaMessage *message = (KafkaMessage *)rkmessage->_private;
+	kafka->released(cluster, rkmessage->len);
+        if (rkmessage->err == RD_KAFKA_RESP_ERR__PURGE_QUEUE || rkmessage->err == RD_KAFKA_RESP_ERR__PURGE_INFLIGHT)
+	{
+		// Purged when the producer was closed, the number purged has already been logged
+		Logger::getLogger()->debug("Kafka message purged: %s", rd_kafka_err2str(rkmessage->err));
+	}
+	else if (rkmessage->err && !kafka->isActive(rk))
+	{
+		// Failures of another cluster are reported periodically rather than per message
+		kafka->skipped(cluster);
+	}
+        else if (rkmessage->err)
 	{
                 Logger::getLogger()->error("Kafka message delivery failed: %s\n",
                         rd_kafka_err2str(rkmessage->err));
@@ -32,11 +177,19 @@ static void dr_msg_cb(rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void
 	else
 	{
                 Logger::getLogger()->debug("Kafka message delivered");
-		Kafka *kafka = (Kafka *)opaque;
-		kafka->success();
-		kafka->setErrorStatus(false);
+		// Deliveries from other clusters or a replaced producer are not part of the current send
+		if (kafka->isActive(rk))
+		{
+			if (!message || message->counted)
+				kafka->success();
+			kafka->setErrorStatus(false);
+		}
 
 	}
+	if (message)
+	{
+		kafka->delivered(message, rkmessage->err == RD_KAFKA_RESP_ERR_NO_ERROR);
+	}
 }
 
 /**
@@ -45,7 +198,18 @@ static void dr_msg_cb(rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void
 static void error_cb(rd_kafka_t *rk, int err, const char *reason, void *opaque)
 {
     rd_kafka_resp_err_t kafkaError = (rd_kafka_resp_err_t) err;
-	Kafka *kafka = (Kafka *)opaque;
+	KafkaCluster *cluster = (KafkaCluster *)opaque;
+	Kafka *kafka = cluster->kafka;
+	if (kafkaError == RD_KAFKA_RESP_ERR__ALL_BROKERS_DOWN)
+	{
+		cluster->up = false;
+	}
+	if (!kafka->isActive(rk))
+	{
+		// Errors from a standby cluster or a producer that is being drained after a reconfiguration
+		Logger::getLogger()->warn("Kafka : %s : %s : %s ", cluster->brokers.c_str(), rd_kafka_err2str(kafkaError), reason );
+		return;
+	}
 	switch (kafkaError)
 	{
 		case RD_KAFKA_RESP_ERR__TRANSPORT:
@@ -70,17 +234,22 @@ static void error_cb(rd_kafka_t *rk, int err, const char *reason, void *opaque)
  */
 static int stats_cb(rd_kafka_t *rk, char *json, size_t json_len, void *opaque)
 {
+	KafkaCluster *cluster = (KafkaCluster *)opaque;
 	Document d;
 	d.Parse(json);
 	if (!d.HasParseError())
 	{
 		for (auto& v : d["brokers"].GetObject())
 		{
+			// The internal broker of the producer is always up
+			if (v.value["nodeid"].GetInt() < 0 || strcmp(v.value["source"].GetString(), "internal") == 0)
+				continue;
 			std::string state = v.value["state"].GetString();
 			if (state == "UP")
 			{
-				Kafka *kafka = (Kafka *)opaque;
-				kafka->setErrorStatus(false);
+				cluster->up = true;
+				if (cluster->kafka->isActive(rk))
+					cluster->kafka->setErrorStatus(false);
 			}
 		}
 	}
@@ -95,6 +264,91 @@ static void pollThreadWrapper(Kafka *kafka)
 	kafka->pollThread();
 }
 
+/**
+ * C Wrapper for the thread that establishes the connection at start up
+ */
+static void warmupThreadWrapper(Kafka *kafka)
+{
+	kafka->warmupThread();
+}
+
+/**
+ * C Wrapper for the thread that establishes the connection of the
+ * producers that replace the current ones after a reconfiguration
+ */
+static void replaceThreadWrapper(Kafka *kafka, vector<KafkaCluster *> clusters, string topic,
+		Kafka::ClusterMode mode, string signature)
+{
+	kafka->replaceThread(clusters, topic, mode, signature);
+}
+
+/**
+ * C Wrapper for the thread that drains the producers that have been replaced
+ */
+static void drainThreadWrapper(Kafka *kafka, vector<KafkaCluster *> clusters)
+{
+	kafka->drainThread(clusters);
+}
+
+/**
+ * Deliver any messages still queued on the producers that have been
+ * replaced and then destroy them. Run on a thread of its own so that
+ * the replacement producers can accept messages in the meantime.
+ *
+ * @param clusters	The clusters whose producers are to be drained
+ */
+void Kafka::drainThread(vector<KafkaCluster *> clusters)
+{
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds(DRAIN_TIMEOUT);
+	for (auto cluster : clusters)
+	{
+		closeProducer(cluster, deadline);
+	}
+	Logger::getLogger()->info("Replaced Kafka producer has been closed");
+}
+
+/**
+ * Close the producer of a cluster and delete the cluster. The delivery
+ * reports are served until the queue of the producer is empty or the
+ * deadline has passed. Messages still queued are then purged so that
+ * their delivery reports release the in-flight data and message state.
+ *
+ * @param cluster	The cluster to close
+ * @param deadline	The time by which outstanding messages must be delivered
+ */
+void Kafka::closeProducer(KafkaCluster *cluster, chrono::steady_clock::time_point deadline)
+{
+	while (rd_kafka_outq_len(cluster->rk) > 0 && chrono::steady_clock::now() < deadline)
+	{
+		{
+			lock_guard<mutex> guard(m_mutex);
+			rd_kafka_poll(cluster->rk, 0);
+		}
+		usleep(DRAIN_POLL * 1000);
+	}
+	int remaining = rd_kafka_outq_len(cluster->rk);
+	if (remaining > 0)
+	{
+		Logger::getLogger()->warn("%d messages discarded from the Kafka producer for %s",
+				remaining, cluster->brokers.c_str());
+		rd_kafka_purge(cluster->rk, RD_KAFKA_PURGE_F_QUEUE | RD_KAFKA_PURGE_F_INFLIGHT);
+		auto purged = chrono::steady_clock::now();
+		while (rd_kafka_outq_len(cluster->rk) > 0
+				&& chrono::steady_clock::now() - purged < chrono::milliseconds(PURGE_TIMEOUT))
+		{
+			{
+				lock_guard<mutex> guard(m_mutex);
+				rd_kafka_poll(cluster->rk, 0);
+			}
+			usleep(DRAIN_POLL * 1000);
+		}
+	}
+	if (cluster->rkt)
+		rd_kafka_topic_destroy(cluster->rkt);
+	rd_kafka_destroy(cluster->rk);
+	delete cluster;
+}
+
 /**
  * Kafka constructor
  *
@@ -104,12 +358,149 @@ static void pollThreadWrapper(Kafka *kafka)
  * @param brokers	List of bootstrap brokers to contact
  * @param topic		THe Kafka topic to publish on
  */
-Kafka::Kafka(ConfigCategory*& configData ) : m_running(true), m_objects(false)
+Kafka::Kafka(ConfigCategory*& configData ) : m_running(true), m_thread(NULL), m_drainThread(NULL),
+	m_warmupThread(NULL), m_cancelWarmup(false), m_warmupDone(false), m_state(STATE_CONNECTING), m_rk(NULL), m_rkt(NULL), m_conf(NULL),
+	m_active(0), m_objects(false), m_deadband(NULL), m_aggregator(NULL), m_projection(NULL),
+	m_traceLatency(false), m_compressor(NULL), m_snapshot(NULL), m_maxInflight(0), m_inflight(0), m_peakInflight(0),
+	m_trimmed(0), m_summaryId(0)
+{
+	m_error = false;
+	// A reconfiguration passes a category named "new", so the service name is recorded once here
+	m_serviceName = configData->getName();
+	m_topic = configData->getValue("topic");
+	m_connectionSignature = connectionSignature(configData);
+	m_clusterMode = clusterMode(configData);
+	m_lastStatistics = chrono::steady_clock::now();
+	m_lastHealthCheck = m_lastStatistics;
+	applyClusterConfig(configData);
+	applyLiveConfig(configData);
+}
+
+/**
+ * Apply the configuration items that control how readings are
+ * processed before they are sent. Called with the send lock held
+ * when the plugin is reconfigured.
+ *
+ * @param configData	plugin configuration data
+ */
+void Kafka::applyLiveConfig(ConfigCategory*& configData)
+{
+	m_objects = configData->getValue("json").compare("Objects") == 0;
+	m_failbackInterval = configData->itemExists("failbackInterval") ? strtoul(configData->getValue("failbackInterval").c_str(), NULL, 10) : 30;
+	m_maxInflight = configData->itemExists("maxInflight") ? strtol(configData->getValue("maxInflight").c_str(), NULL, 10) * 1024 : 0;
+
+	// The last values sent are kept unless the deadband settings change
+	string deadband = configData->itemExists("deadband") ? configData->getValue("deadband") : "None";
+	bool exception = deadband.compare("None") != 0;
+	Deadband::Mode mode = deadband.compare("Percent") == 0 ? Deadband::DEADBAND_PERCENT : Deadband::DEADBAND_ABSOLUTE;
+	double value = exception ? strtod(configData->getValue("deadbandValue").c_str(), NULL) : 0.0;
+	unsigned long heartbeat = exception ? strtoul(configData->getValue("heartbeat").c_str(), NULL, 10) : 0;
+	if (m_deadband && (!exception || !m_deadband->matches(mode, value, heartbeat)))
+	{
+		delete m_deadband;
+		m_deadband = NULL;
+	}
+	if (exception && !m_deadband)
+	{
+		m_deadband = new Deadband(mode, value, heartbeat);
+		Logger::getLogger()->info("Report by exception enabled with a %s deadband of %g and heartbeat of %lu seconds",
+				deadband.c_str(), value, heartbeat);
+	}
+
+	if (m_projection)
+	{
+		delete m_projection;
+		m_projection = NULL;
+	}
+	if (configData->itemExists("filter"))
+	{
+		Projection *projection = new Projection(configData->getValue("filter"));
+		if (projection->hasRules())
+			m_projection = projection;
+		else
+			delete projection;
+	}
+
+	m_traceLatency = configData->itemExists("traceLatency") && configData->getValue("traceLatency").compare("true") == 0;
+	if (m_traceLatency)
+	{
+		m_latency.configure(strtoul(configData->getValue("latencyInterval").c_str(), NULL, 10),
+				strtoul(configData->getValue("latencyTopN").c_str(), NULL, 10),
+				configData->getValue("latencyAsset"));
+	}
+
+	// A dictionary trained from the messages sent is kept unless the compression settings change
+	bool zstd = configData->itemExists("messageCompression") && configData->getValue("messageCompression").compare("zstd") == 0;
+	int level = zstd ? atoi(configData->getValue("zstdLevel").c_str()) : 0;
+	string dictionary = zstd ? configData->getValue("zstdDictionary") : "";
+	unsigned int trainSamples = zstd ? strtoul(configData->getValue("zstdTrainSamples").c_str(), NULL, 10) : 0;
+	if (m_compressor && (!zstd || !m_compressor->matches(level, dictionary, trainSamples)))
+	{
+		delete m_compressor;
+		m_compressor = NULL;
+	}
+	if (zstd && !m_compressor)
+	{
+		m_compressor = new Compressor(level, dictionary, trainSamples);
+		if (!m_compressor->isValid())
+		{
+			delete m_compressor;
+			m_compressor = NULL;
+		}
+	}
+
+	// Statistics are sent as a snapshot message per send, keyed by the service
+	string encoding = configData->itemExists("snapshotEncoding") ? configData->getValue("snapshotEncoding") : "None";
+	bool snapshot = configData->getValue("source").compare("statistics") == 0 && encoding.compare("None") != 0;
+	bool delta = encoding.compare("Delta") == 0;
+	unsigned int fullInterval = snapshot ? strtoul(configData->getValue("snapshotFullInterval").c_str(), NULL, 10) : 0;
+	if (m_snapshot && (!snapshot || !m_snapshot->matches(delta, fullInterval)))
+	{
+		delete m_snapshot;
+		m_snapshot = NULL;
+	}
+	if (snapshot)
+	{
+		if (!m_snapshot)
+			m_snapshot = new StatisticsSnapshot(delta, fullInterval);
+		m_snapshotKey = configData->getValue("snapshotKey");
+		if (m_snapshotKey.empty())
+			m_snapshotKey = m_serviceName;
+	}
+
+	// Open windows are kept unless the window size changes
+	bool aggregate = configData->itemExists("aggregate") && configData->getValue("aggregate").compare("true") == 0;
+	unsigned long window = aggregate ? strtoul(configData->getValue("aggregateWindow").c_str(), NULL, 10) : 0;
+	if (m_aggregator && (!aggregate || m_aggregator->getWindow() != window))
+	{
+		// The readings in the open windows have already been reported as sent
+		vector<Reading *> summaries;
+		m_aggregator->flush(summaries);
+		if (!summaries.empty())
+		{
+			Logger::getLogger()->info("The summaries of %d open aggregation windows will be sent with the next block of readings",
+					(int)summaries.size());
+		}
+		queueSummaries(summaries);
+		delete m_aggregator;
+		m_aggregator = NULL;
+	}
+	if (aggregate && !m_aggregator)
+	{
+		m_aggregator = new Aggregator(window);
+		Logger::getLogger()->info("Readings aggregated over windows of %lu milliseconds", window);
+	}
+}
+
+/**
+ * Create the librdkafka configuration from the plugin configuration
+ *
+ * @param configData	plugin configuration data
+ */
+void Kafka::applyConfig(ConfigCategory*& configData)
 {
 	try
 	{
-		m_error = false;
-		m_topic = configData->getValue("topic");
 		m_conf = rd_kafka_conf_new();
 
 		// Set basic configuration
@@ -132,7 +523,6 @@ Kafka::Kafka(ConfigCategory*& configData ) : m_running(true), m_objects(false)
 		rd_kafka_conf_set_log_cb(m_conf, logCallback);
 
 		rd_kafka_conf_set_dr_msg_cb(m_conf, dr_msg_cb);
-		rd_kafka_conf_set_opaque(m_conf, this);
 	}
 	catch(std::exception &ex)
 	{
@@ -142,119 +532,604 @@ Kafka::Kafka(ConfigCategory*& configData ) : m_running(true), m_objects(false)
 }
 
 /**
- * Establish connection with Kafka broker
+ * Create the librdkafka configuration of the primary cluster, left in
+ * m_conf, and of any additional cluster profiles
  *
+ * @param configData	plugin configuration data
  */
-void Kafka::connect()
+void Kafka::applyClusterConfig(ConfigCategory*& configData)
 {
-	char errstr[512];
-	m_rk = rd_kafka_new(RD_KAFKA_PRODUCER, m_conf, errstr, sizeof(errstr));
-	if (!m_rk)
+	for (auto conf : m_profileConfs)
 	{
-		Logger::getLogger()->error(errstr);
-		return;
+		rd_kafka_conf_destroy(conf);
 	}
-	m_rkt = rd_kafka_topic_new(m_rk, m_topic.c_str(), NULL);
-	if (!m_rkt)
+	m_profileConfs.clear();
+
+	applyConfig(configData);
+	if (clusterMode(configData) == CLUSTER_SINGLE || !configData->itemExists("clusters"))
 	{
-		Logger::getLogger()->error("Failed to create topic object: %s\n", rd_kafka_err2str(rd_kafka_last_error()));
-		rd_kafka_destroy(m_rk);
 		return;
 	}
-	m_thread = new thread(pollThreadWrapper, this);
 
+	rd_kafka_conf_t *primary = m_conf;
+	Document d;
+	d.Parse(configData->getValue("clusters").c_str());
+	if (d.HasParseError() || !d.IsObject() || !d.HasMember("clusters") || !d["clusters"].IsArray())
+	{
+		Logger::getLogger()->error("The Kafka cluster list is not valid, only the primary cluster will be used");
+		return;
+	}
+	for (auto& profile : d["clusters"].GetArray())
+	{
+		if (!profile.IsObject() || !profile.HasMember("brokers") || !profile["brokers"].IsString())
+		{
+			Logger::getLogger()->error("Kafka cluster profiles must define the brokers, profile ignored");
+			continue;
+		}
+		ConfigCategory *profileData = profileConfig(configData, profile);
+		try
+		{
+			applyConfig(profileData);
+			m_profileConfs.push_back(m_conf);
+		}
+		catch (...)
+		{
+			Logger::getLogger()->error("Invalid configuration for Kafka cluster %s, cluster ignored",
+					profile["brokers"].GetString());
+		}
+		delete profileData;
+	}
+	m_conf = primary;
 }
 
 /**
- * certificateStoreLocation
- *
- * Fetch certificate store location
+ * Build the configuration of a cluster profile. Connection items not
+ * given in the profile are taken from the plugin configuration. The
+ * passwords are taken from the cluster password items, or from the
+ * plugin configuration if those are blank, and never from the profile.
  *
- * @returns Path for certificate store location
+ * @param configData	plugin configuration data
+ * @param profile	The cluster profile
+ * @return	The configuration of the cluster
  */
-string	Kafka::certificateStoreLocation()
+ConfigCategory *Kafka::profileConfig(ConfigCategory*& configData, const Value& profile)
 {
-	string storeLocation = {};
-	char* env = NULL;
-	env = getenv("FLEDGE_DATA");
-	if (env)
-	{
-		storeLocation = std::string(env) + "/etc/certs/";
-	}
-	else
+	StringBuffer buffer;
+	Writer<StringBuffer> writer(buffer);
+	writer.StartObject();
+	for (int i = 0; connectionItems[i]; i++)
 	{
-		env = getenv("FLEDGE_ROOT");
-		if (env)
-			storeLocation = std::string(env) + "/data/etc/certs/";
+		const char *secret = NULL;
+		for (int j = 0; clusterSecrets[j][0]; j++)
+		{
+			if (strcmp(connectionItems[i], clusterSecrets[j][0]) == 0)
+				secret = clusterSecrets[j][1];
+		}
+		string value;
+		if (secret)
+		{
+			if (profile.HasMember(connectionItems[i]))
+			{
+				Logger::getLogger()->warn("The %s of Kafka cluster %s must be set in the cluster password items, the value in the profile is ignored",
+						connectionItems[i], profile["brokers"].GetString());
+			}
+			if (configData->itemExists(secret))
+				value = configData->getValue(secret);
+			if (value.empty() && configData->itemExists(connectionItems[i]))
+				value = configData->getValue(connectionItems[i]);
+		}
+		else if (profile.HasMember(connectionItems[i]) && profile[connectionItems[i]].IsString())
+			value = profile[connectionItems[i]].GetString();
+		else if (configData->itemExists(connectionItems[i]))
+			value = configData->getValue(connectionItems[i]);
 		else
-			storeLocation = "/usr/local/fledge/data/etc/certs/";
+			continue;
+		writer.Key(connectionItems[i]);
+		writer.StartObject();
+		writer.Key("description");
+		writer.String(connectionItems[i]);
+		writer.Key("type");
+		writer.String("string");
+		writer.Key("default");
+		writer.String(value.c_str());
+		writer.Key("value");
+		writer.String(value.c_str());
+		writer.EndObject();
 	}
-
-	return storeLocation;
+	writer.EndObject();
+	return new ConfigCategory(configData->getName(), buffer.GetString());
 }
 
 /**
- * applyConfig_Basic
- *
- * Setup basic kafka configuration
+ * Create the producers for the primary cluster and any additional
+ * clusters from the configurations created by applyClusterConfig
  *
- * @param configData	plugin configuration data
+ * @param topic		The topic to send to
+ * @param clusters	Vector to which the clusters are added, the primary first
+ * @param mode		The cluster mode
+ * @return	False if the primary cluster could not be created
  */
-
-void Kafka::applyConfig_Basic(ConfigCategory*& configData)
+bool Kafka::createClusters(const string& topic, vector<KafkaCluster *>& clusters, ClusterMode mode)
 {
-	char	errstr[512];
-	// SET Basic Config
-	if (rd_kafka_conf_set(m_conf, "bootstrap.servers", configData->getValue("brokers").c_str(),
-                              errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+	vector<rd_kafka_conf_t *> profiles = m_profileConfs;
+	m_profileConfs.clear();
+
+	KafkaCluster *primary = new KafkaCluster(this);
+	if (!createProducer(topic, primary))
 	{
-		Logger::getLogger()->fatal(errstr);
-		rd_kafka_conf_destroy(m_conf);
-		throw exception();
+		delete primary;
+		for (auto conf : profiles)
+		{
+			rd_kafka_conf_destroy(conf);
+		}
+		return false;
 	}
+	clusters.push_back(primary);
 
-	if (rd_kafka_conf_set(m_conf, "request.required.acks", "all",
-                              errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+	for (auto conf : profiles)
 	{
-		Logger::getLogger()->fatal(errstr);
-		rd_kafka_conf_destroy(m_conf);
-		throw exception();
+		m_conf = conf;
+		KafkaCluster *cluster = new KafkaCluster(this);
+		if (createProducer(topic, cluster))
+		{
+			clusters.push_back(cluster);
+		}
+		else
+		{
+			delete cluster;
+		}
 	}
-
-	if (rd_kafka_conf_set(m_conf, "compression.codec", configData->getValue("compression").c_str(),
-                              errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+	if (clusters.size() > 1)
 	{
-		// Get previous compression codec
-		char compressionCodec[32];
-		size_t length = sizeof(compressionCodec);
-		rd_kafka_conf_res_t res;
-		res = rd_kafka_conf_get(m_conf, "compression.codec", compressionCodec, &length);
-		
-		Logger::getLogger()->warn("Compression codec %s couldn't be set because %s. Continuing with %s compression", configData->getValue("compression").c_str(), errstr, compressionCodec);
+		Logger::getLogger()->info("Kafka %s across %d clusters", mode == CLUSTER_FANOUT ? "fan-out" : "failover",
+				(int)clusters.size());
 	}
+	return true;
+}
 
-	if (rd_kafka_conf_set(m_conf, "statistics.interval.ms","2000",
-										errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+/**
+ * Establish connection with Kafka broker
+ *
+ */
+void Kafka::connect()
+{
+	if (!createClusters(m_topic, m_clusters, m_clusterMode))
 	{
-		Logger::getLogger()->debug("Failed to set statistics collection interval: %s",errstr);
-		rd_kafka_conf_destroy(m_conf);
-		throw exception();
+		return;
 	}
-	rd_kafka_conf_set_stats_cb(m_conf, stats_cb);
+	m_active = 0;
+	m_rk = m_clusters[0]->rk;
+	m_rkt = m_clusters[0]->rkt;
+	m_thread = new thread(pollThreadWrapper, this);
+	m_warmupDone = false;
+	m_warmupThread = new thread(warmupThreadWrapper, this);
 
-	// Set the error callback function
-	rd_kafka_conf_set_error_cb(m_conf, error_cb);
 }
 
 /**
- * applyConfig_SASL_PLAINTEXT
- *
- * Setup SASL_PLAINTEXT kafka configuration
- *
- * @param configData	plugin configuration data
+ * Thread that warms up the connection created by connect, or the
+ * topic set by a reconfiguration, so that the first send does not pay
+ * the cost of establishing it
  */
-
-void Kafka::applyConfig_SASL_PLAINTEXT(ConfigCategory*& configData, const string& kafkaSecurityProtocol)
+void Kafka::warmupThread()
+{
+	// The clusters are only replaced once this thread has been stopped
+	vector<KafkaCluster *> clusters;
+	{
+		lock_guard<mutex> guard(m_mutex);
+		clusters = m_clusters;
+	}
+	if (clusters.empty())
+	{
+		return;
+	}
+	bool ready = warmup(clusters[0]->rk, clusters[0]->rkt, WARMUP_TIMEOUT);
+	if (m_cancelWarmup)
+	{
+		return;
+	}
+	m_state = ready ? STATE_READY : STATE_UNAVAILABLE;
+
+	// Check the other clusters once so that their state is known before they are needed
+	for (unsigned int i = 1; i < clusters.size() && m_running && !m_cancelWarmup; i++)
+	{
+		clusters[i]->up = warmup(clusters[i]->rk, clusters[i]->rkt, METADATA_TIMEOUT);
+	}
+	m_warmupDone = !m_cancelWarmup;
+}
+
+/**
+ * Thread that warms up the producers created for a new connection
+ * configuration and then replaces the current producers with them.
+ * Data continues to be sent with the current producers until the new
+ * ones are ready, the current producers are then drained in the
+ * background.
+ *
+ * @param clusters	The new clusters
+ * @param topic		The topic of the new clusters
+ * @param mode		The new cluster mode
+ * @param signature	The connection signature of the new configuration
+ */
+void Kafka::replaceThread(vector<KafkaCluster *> clusters, string topic, ClusterMode mode, string signature)
+{
+	ConnectionState state = warmup(clusters[0]->rk, clusters[0]->rkt, WARMUP_TIMEOUT) ? STATE_READY : STATE_UNAVAILABLE;
+	for (unsigned int i = 1; i < clusters.size() && m_running && !m_cancelWarmup; i++)
+	{
+		clusters[i]->up = warmup(clusters[i]->rk, clusters[i]->rkt, METADATA_TIMEOUT);
+	}
+	if (!m_running || m_cancelWarmup)
+	{
+		// Superseded by a later configuration or the plugin is shutting down
+		for (auto cluster : clusters)
+		{
+			rd_kafka_topic_destroy(cluster->rkt);
+			rd_kafka_destroy(cluster->rk);
+			delete cluster;
+		}
+		Logger::getLogger()->info("Kafka producer for the replaced connection configuration discarded");
+		return;
+	}
+
+	vector<KafkaCluster *> old;
+	{
+		lock_guard<mutex> guard(m_mutex);
+		old.swap(m_clusters);
+		m_clusters.swap(clusters);
+		activate(0);
+		m_topic = topic;
+		m_clusterMode = mode;
+		m_connectionSignature = signature;
+		m_state = state;
+		m_warmupDone = true;
+	}
+	Logger::getLogger()->info("Kafka producer replaced for the new connection configuration");
+
+	if (!m_thread)
+	{
+		m_thread = new thread(pollThreadWrapper, this);
+	}
+	if (m_drainThread)
+	{
+		m_drainThread->join();
+		delete m_drainThread;
+		m_drainThread = NULL;
+	}
+	if (!old.empty())
+	{
+		m_drainThread = new thread(drainThreadWrapper, this, old);
+	}
+}
+
+/**
+ * Stop any warm up in progress, a pending replacement of the producers
+ * is discarded
+ */
+void Kafka::stopWarmup()
+{
+	if (m_warmupThread)
+	{
+		m_cancelWarmup = true;
+		m_warmupThread->join();
+		delete m_warmupThread;
+		m_warmupThread = NULL;
+		m_cancelWarmup = false;
+	}
+}
+
+/**
+ * Resolve the brokers, authenticate and retrieve the metadata for the
+ * topic, including the partition leaders, for a new producer.
+ *
+ * @param rk		The producer to warm up
+ * @param rkt		The topic handle of the producer
+ * @param timeout	The time in milliseconds to keep trying
+ * @return	True if the topic metadata was retrieved
+ */
+bool Kafka::warmup(rd_kafka_t *rk, rd_kafka_topic_t *rkt, long timeout)
+{
+	auto start = chrono::steady_clock::now();
+	long elapsed = 0;
+	const struct rd_kafka_metadata *metadata = NULL;
+	rd_kafka_resp_err_t err;
+	do {
+		err = rd_kafka_metadata(rk, 0, rkt, &metadata, METADATA_TIMEOUT);
+		elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+	} while (err != RD_KAFKA_RESP_ERR_NO_ERROR && m_running && !m_cancelWarmup && elapsed < timeout);
+
+	if (err != RD_KAFKA_RESP_ERR_NO_ERROR)
+	{
+		Logger::getLogger()->warn("Kafka connection not established after %ld ms: %s",
+				elapsed, rd_kafka_err2str(err));
+		return false;
+	}
+
+	int partitions = 0, leaders = 0;
+	for (int i = 0; i < metadata->topic_cnt; i++)
+	{
+		const rd_kafka_metadata_topic_t *topic = &metadata->topics[i];
+		if (topic->err != RD_KAFKA_RESP_ERR_NO_ERROR)
+		{
+			Logger::getLogger()->warn("Kafka metadata for topic %s: %s", topic->topic, rd_kafka_err2str(topic->err));
+		}
+		for (int j = 0; j < topic->partition_cnt; j++)
+		{
+			partitions++;
+			if (topic->partitions[j].leader >= 0)
+				leaders++;
+		}
+	}
+	Logger::getLogger()->info("Kafka connection ready in %ld ms, %d brokers, topic %s has %d partitions with %d leaders",
+			elapsed, metadata->broker_cnt, rd_kafka_topic_name(rkt), partitions, leaders);
+	rd_kafka_metadata_destroy(metadata);
+	return true;
+}
+
+/**
+ * Create a producer and topic handle from the current librdkafka
+ * configuration. The configuration is consumed by this call.
+ *
+ * @param topic		The topic to create the handle for
+ * @param cluster	The cluster to create the producer for
+ * @return	True if the producer was created
+ */
+bool Kafka::createProducer(const string& topic, KafkaCluster *cluster)
+{
+	char errstr[512];
+	size_t size = sizeof(errstr);
+	if (rd_kafka_conf_get(m_conf, "bootstrap.servers", errstr, &size) == RD_KAFKA_CONF_OK)
+	{
+		cluster->brokers = errstr;
+	}
+	rd_kafka_conf_set_opaque(m_conf, cluster);
+	rd_kafka_t **rk = &cluster->rk;
+	rd_kafka_topic_t **rkt = &cluster->rkt;
+	*rk = rd_kafka_new(RD_KAFKA_PRODUCER, m_conf, errstr, sizeof(errstr));
+	if (!*rk)
+	{
+		Logger::getLogger()->error(errstr);
+		rd_kafka_conf_destroy(m_conf);
+		m_conf = NULL;
+		return false;
+	}
+	// The configuration is now owned by the producer
+	m_conf = NULL;
+	*rkt = rd_kafka_topic_new(*rk, topic.c_str(), NULL);
+	if (!*rkt)
+	{
+		Logger::getLogger()->error("Failed to create topic object: %s\n", rd_kafka_err2str(rd_kafka_last_error()));
+		rd_kafka_destroy(*rk);
+		*rk = NULL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Build a string from the values of the configuration items that
+ * can only be applied by creating a new producer.
+ *
+ * @param configData	plugin configuration data
+ * @return	The connection signature of the configuration
+ */
+string Kafka::connectionSignature(ConfigCategory*& configData)
+{
+	string signature;
+	for (int i = 0; connectionItems[i]; i++)
+	{
+		if (configData->itemExists(connectionItems[i]))
+		{
+			signature += configData->getValue(connectionItems[i]);
+		}
+		signature += '\0';
+	}
+	for (int i = 0; clusterItems[i]; i++)
+	{
+		if (configData->itemExists(clusterItems[i]))
+		{
+			signature += configData->getValue(clusterItems[i]);
+		}
+		signature += '\0';
+	}
+	return signature;
+}
+
+/**
+ * Apply a new configuration to the running plugin
+ *
+ * Changes to the topic or JSON handling are applied to the existing
+ * producer between calls to send. Changes to the connection settings
+ * create a new producer that is warmed up in the background and then
+ * replaces the existing one, the old producer is drained on a
+ * background thread.
+ *
+ * @param configData	The new plugin configuration
+ */
+void Kafka::reconfigure(ConfigCategory*& configData)
+{
+	string topic = configData->getValue("topic");
+	string signature = connectionSignature(configData);
+
+	// The warm up uses the topic handles and a pending replacement is superseded by this configuration
+	stopWarmup();
+	bool warming = !m_warmupDone;
+
+	if (signature == m_connectionSignature)
+	{
+		lock_guard<mutex> guard(m_mutex);
+		if (m_rk && topic.compare(m_topic) != 0)
+		{
+			vector<rd_kafka_topic_t *> handles;
+			for (auto cluster : m_clusters)
+			{
+				rd_kafka_topic_t *rkt = rd_kafka_topic_new(cluster->rk, topic.c_str(), NULL);
+				if (!rkt)
+				{
+					break;
+				}
+				handles.push_back(rkt);
+			}
+			if (handles.size() < m_clusters.size())
+			{
+				Logger::getLogger()->error("Failed to create topic object for %s: %s, continuing with topic %s",
+						topic.c_str(), rd_kafka_err2str(rd_kafka_last_error()), m_topic.c_str());
+				for (auto rkt : handles)
+				{
+					rd_kafka_topic_destroy(rkt);
+				}
+				topic = m_topic;
+			}
+			else
+			{
+				for (unsigned int i = 0; i < m_clusters.size(); i++)
+				{
+					if (m_clusters[i]->rkt)
+						rd_kafka_topic_destroy(m_clusters[i]->rkt);
+					m_clusters[i]->rkt = handles[i];
+				}
+				m_rkt = m_clusters[m_active]->rkt;
+				warming = true;
+			}
+		}
+		m_topic = topic;
+		applyLiveConfig(configData);
+		if (warming && m_rk)
+		{
+			// Fetch the metadata of the new topic, or complete the interrupted warm up
+			m_warmupDone = false;
+			m_warmupThread = new thread(warmupThreadWrapper, this);
+		}
+		Logger::getLogger()->info("Kafka configuration updated, sending to topic %s", m_topic.c_str());
+		return;
+	}
+
+	// Connection settings have changed, create new producers
+	try
+	{
+		applyClusterConfig(configData);
+	}
+	catch (...)
+	{
+		// The configuration has already been destroyed by the failing apply
+		m_conf = NULL;
+		Logger::getLogger()->error("Invalid Kafka connection configuration, continuing with the existing producer");
+		return;
+	}
+	ClusterMode mode = clusterMode(configData);
+	vector<KafkaCluster *> clusters;
+	if (!createClusters(topic, clusters, mode))
+	{
+		Logger::getLogger()->error("Unable to create a Kafka producer for the new configuration, continuing with the existing producer");
+		return;
+	}
+	{
+		lock_guard<mutex> guard(m_mutex);
+		applyLiveConfig(configData);
+	}
+	m_warmupThread = new thread(replaceThreadWrapper, this, clusters, topic, mode, signature);
+	Logger::getLogger()->info("Kafka connection configuration changed, data is sent with the existing producer until the new producer is ready");
+}
+
+/**
+ * certificateStoreLocation
+ *
+ * Fetch certificate store location
+ *
+ * @returns Path for certificate store location
+ */
+string	Kafka::certificateStoreLocation()
+{
+	string storeLocation = {};
+	char* env = NULL;
+	env = getenv("FLEDGE_DATA");
+	if (env)
+	{
+		storeLocation = std::string(env) + "/etc/certs/";
+	}
+	else
+	{
+		env = getenv("FLEDGE_ROOT");
+		if (env)
+			storeLocation = std::string(env) + "/data/etc/certs/";
+		else
+			storeLocation = "/usr/local/fledge/data/etc/certs/";
+	}
+
+	return storeLocation;
+}
+
+/**
+ * applyConfig_Basic
+ *
+ * Setup basic kafka configuration
+ *
+ * @param configData	plugin configuration data
+ */
+
+void Kafka::applyConfig_Basic(ConfigCategory*& configData)
+{
+	char	errstr[512];
+	// SET Basic Config
+	if (rd_kafka_conf_set(m_conf, "bootstrap.servers", configData->getValue("brokers").c_str(),
+                              errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+	{
+		Logger::getLogger()->fatal(errstr);
+		rd_kafka_conf_destroy(m_conf);
+		throw exception();
+	}
+
+	if (rd_kafka_conf_set(m_conf, "request.required.acks", "all",
+                              errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+	{
+		Logger::getLogger()->fatal(errstr);
+		rd_kafka_conf_destroy(m_conf);
+		throw exception();
+	}
+
+	if (rd_kafka_conf_set(m_conf, "compression.codec", configData->getValue("compression").c_str(),
+                              errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+	{
+		// Get previous compression codec
+		char compressionCodec[32];
+		size_t length = sizeof(compressionCodec);
+		rd_kafka_conf_res_t res;
+		res = rd_kafka_conf_get(m_conf, "compression.codec", compressionCodec, &length);
+		
+		Logger::getLogger()->warn("Compression codec %s couldn't be set because %s. Continuing with %s compression", configData->getValue("compression").c_str(), errstr, compressionCodec);
+	}
+
+	if (rd_kafka_conf_set(m_conf, "statistics.interval.ms","2000",
+										errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+	{
+		Logger::getLogger()->debug("Failed to set statistics collection interval: %s",errstr);
+		rd_kafka_conf_destroy(m_conf);
+		throw exception();
+	}
+	rd_kafka_conf_set_stats_cb(m_conf, stats_cb);
+
+	// Bound the memory used by the librdkafka queue, with headroom above the in-flight limit
+	long maxInflight = configData->itemExists("maxInflight") ? strtol(configData->getValue("maxInflight").c_str(), NULL, 10) : 0;
+	if (maxInflight > 0)
+	{
+		if (rd_kafka_conf_set(m_conf, "queue.buffering.max.kbytes", to_string(maxInflight * QUEUE_HEADROOM).c_str(),
+					errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+		{
+			Logger::getLogger()->warn("Failed to limit the Kafka queue size: %s", errstr);
+		}
+	}
+
+	// Set the error callback function
+	rd_kafka_conf_set_error_cb(m_conf, error_cb);
+}
+
+/**
+ * applyConfig_SASL_PLAINTEXT
+ *
+ * Setup SASL_PLAINTEXT kafka configuration
+ *
+ * @param configData	plugin configuration data
+ */
+
+void Kafka::applyConfig_SASL_PLAINTEXT(ConfigCategory*& configData, const string& kafkaSecurityProtocol)
 {
 	char	errstr[512];
 	// Set the security protocol
@@ -403,20 +1278,76 @@ void Kafka::applyConfig_SSL(ConfigCategory*& configData, const string& kafkaSecu
  */
 Kafka::~Kafka()
 {
-	if(m_rk && m_rkt)
-	{
-		rd_kafka_flush(m_rk, 1000);
-		rd_kafka_topic_destroy(m_rkt);
-		rd_kafka_destroy(m_rk);
-	}
-	
 	m_running = false;
 	
+	stopWarmup();
+
 	if (m_thread)
 	{
 		m_thread->join();
 		delete m_thread;
 	}
+
+	if (m_drainThread)
+	{
+		m_drainThread->join();
+		delete m_drainThread;
+	}
+
+	// Send the summaries of the open windows, their readings have already been reported as sent
+	if (m_aggregator)
+	{
+		vector<Reading *> summaries;
+		m_aggregator->flush(summaries);
+		queueSummaries(summaries);
+	}
+	if (m_rk && !m_summaries.empty() && !m_error)
+	{
+		sendSummaries();
+	}
+
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds(1000);
+	for (auto cluster : m_clusters)
+	{
+		closeProducer(cluster, deadline);
+	}
+	if (m_conf)
+	{
+		rd_kafka_conf_destroy(m_conf);
+	}
+	for (auto conf : m_profileConfs)
+	{
+		rd_kafka_conf_destroy(conf);
+	}
+	if (m_deadband)
+	{
+		delete m_deadband;
+	}
+	if (m_aggregator)
+	{
+		delete m_aggregator;
+	}
+	if (m_projection)
+	{
+		delete m_projection;
+	}
+	if (m_compressor)
+	{
+		delete m_compressor;
+	}
+	if (m_snapshot)
+	{
+		delete m_snapshot;
+	}
+	if (!m_summaries.empty())
+	{
+		Logger::getLogger()->warn("%d aggregated summaries could not be delivered before shutdown and have been discarded",
+				(int)m_summaries.size());
+	}
+	for (auto& summary : m_summaries)
+	{
+		delete summary.second.reading;
+	}
 }
 
 /**
@@ -448,6 +1379,37 @@ void Kafka::logCallback(const rd_kafka_t *rk, int level, const char *facility, c
 	}
 }
 
+/**
+ * Called from the delivery report of a message that carries state,
+ * with the send lock held, to complete and release the state
+ *
+ * @param message	The state of the message
+ * @param success	The message was acknowledged by the broker
+ */
+void Kafka::delivered(KafkaMessage *message, bool success)
+{
+	if (message->latency)
+	{
+		m_latency.delivered(message->latency, success);
+	}
+	if (message->deadband)
+	{
+		if (m_deadband)
+		{
+			if (success)
+				m_deadband->commit(message->deadband);
+			else
+				m_deadband->rollback(message->deadband);
+		}
+		delete message->deadband;
+	}
+	if (message->summary)
+	{
+		summaryDelivered(message->summary, success);
+	}
+	delete message;
+}
+
 /**
  * Polling thread used to collect delivery status
  */
@@ -456,7 +1418,11 @@ Kafka::pollThread()
 {
 	while (m_running)
 	{
-		rd_kafka_poll(m_rk, 0);
+		{
+			lock_guard<mutex> guard(m_mutex);
+			for (auto cluster : m_clusters)
+				rd_kafka_poll(cluster->rk, 0);
+		}
 		usleep(100);
 	}
 }
@@ -468,18 +1434,31 @@ Kafka::pollThread()
  * @return	The number of readings sent
  */
 uint32_t
-Kafka::send(const vector<Reading *> readings)
+Kafka::send(const vector<Reading *>& readings)
 {
 
 	Logger::getLogger()->debug("Kafka send called");
+	lock_guard<mutex> guard(m_mutex);
 	m_sent = 0;
 	// Check if kafka connection and topic is valid
-	if (!m_rk && !m_rkt)
+	if (!m_rk || !m_rkt)
 	{
 		Logger::getLogger()->warn("Data is not sent due to invalid Kafka connection or topic");
 		return m_sent;
 	}
 
+	// Hold data back until the connection established at start up is ready
+	if (m_state == STATE_CONNECTING)
+	{
+		Logger::getLogger()->info("Data is not sent as the Kafka connection is still being established");
+		return m_sent;
+	}
+
+	if (m_clusterMode == CLUSTER_FAILOVER)
+	{
+		checkClusters();
+	}
+
 	//Check if previous errors status is cleared before sending to Kafka borker
 	if (m_error)
 	{
@@ -487,98 +1466,684 @@ Kafka::send(const vector<Reading *> readings)
 		return m_sent;
 	}
 
+	if (m_snapshot)
+	{
+		uint32_t sent = sendSnapshot(readings);
+		reportMemory();
+		return sent;
+	}
+
+	if (m_aggregator)
+	{
+		// Readings are consumed by the aggregator, only summaries of closed windows are sent
+		for (auto it = readings.cbegin(); it != readings.cend(); ++it)
+		{
+			m_aggregator->add(*it, m_projection ? m_projection->getMask(*it) : NULL);
+		}
+		vector<Reading *> summaries;
+		m_aggregator->close(summaries);
+		queueSummaries(summaries);
+	}
+
+	// Summaries are sent first, including those left when aggregation was disabled
+	bool sending = sendSummaries();
+
 	int cnt = 0;
-	for (auto it = readings.cbegin(); it != readings.cend(); ++it)
+	for (auto it = readings.cbegin(); sending && !m_aggregator && it != readings.cend(); ++it)
 	{
 		cnt++;
-		ostringstream	payload;
-		string assetName = (*it)->getAssetName();
-		payload << "{ \"asset\" : " << quote(assetName) << ", ";
-		payload << "\"timestamp\" : " << quote((*it)->getAssetDateUserTime(Reading::FMT_ISO8601MS, true)) << ", ";
-		vector<Datapoint *> datapoints = (*it)->getReadingData();
-		bool isPayloadToSend = false;
-		for (auto dit = datapoints.cbegin(); dit != datapoints.cend();
-					++dit)
-		{
-			DatapointValue dpv = (*dit)->getData();
-			DatapointValue::dataTagType dataType = dpv.getType();
-			if ( dataType == DatapointValue::T_IMAGE || dataType == DatapointValue::T_DATABUFFER )
-			{
-				// SKIP Image and databuffer type
-				Logger::getLogger()->info("Image and databuffer are not supported in kafka north implementation. Datapoint %s of asset %s has image/databuffer",(*dit)->getName().c_str(), assetName.c_str());
-				success();
-				continue;
-			}
-			isPayloadToSend = true;
-			if (dit != datapoints.cbegin())
-			{
-				payload << ",";
-			}
-			payload << quote((*dit)->getName());
+		const ProjectionMask *mask = m_projection ? m_projection->getMask(*it) : NULL;
+		ProduceStatus status = sendReading(*it, mask, true);
+		if (status == PRODUCE_LIMITED)
+		{
+			Logger::getLogger()->warn("Kafka in-flight data limit reached, %d messages will be sent later",
+					(int)(readings.cend() - it));
+			m_trimmed++;
+		}
+		if (status != PRODUCE_OK)
+		{
+			break;
+		}
+		rd_kafka_poll(m_rk, 0);
+	}
+	while (rd_kafka_outq_len(m_rk) > 0 && !m_error)
+	{
+		rd_kafka_poll(m_rk, 0);
+		rd_kafka_flush(m_rk, 1000);
+	}
+	Logger::getLogger()->debug("Return with %d messages sent from %d", m_sent, cnt);
 
-			switch (dpv.getType())
-			{
-				case DatapointValue::T_STRING:
-					{
-					string value = dpv.toStringValue();
-					if (m_objects)
+	// The latency report is delivered in the background and not counted as sent
+	if (m_traceLatency && !m_error && m_latency.reportDue())
+	{
+		vector<Reading *> report;
+		m_latency.report(report);
+		for (auto reading : report)
+		{
+			sendReading(reading, NULL, false);
+			delete reading;
+		}
+	}
+
+	if (m_payload.capacity() > MAX_RETAINED_PAYLOAD)
+	{
+		string().swap(m_payload);
+	}
+	reportMemory();
+
+	if (m_aggregator)
+	{
+		// The readings are held in the aggregator, summaries are kept until they are delivered
+		return readings.size();
+	}
+	return m_sent;
+}
+
+/**
+ * Add summaries to those waiting to be sent. If too many summaries are
+ * waiting the oldest are discarded.
+ *
+ * @param summaries	The summary readings, owned by the plugin once added
+ */
+void Kafka::queueSummaries(vector<Reading *>& summaries)
+{
+	for (auto reading : summaries)
+	{
+		Summary summary;
+		summary.reading = reading;
+		summary.inflight = false;
+		m_summaries.insert(pair<unsigned long, Summary>(++m_summaryId, summary));
+	}
+	summaries.clear();
+	if (m_summaries.size() > MAX_PENDING_SUMMARIES)
+	{
+		size_t excess = m_summaries.size() - MAX_PENDING_SUMMARIES;
+		Logger::getLogger()->warn("Discarding %d undelivered summary readings", (int)excess);
+		for (size_t i = 0; i < excess; i++)
+		{
+			delete m_summaries.begin()->second.reading;
+			m_summaries.erase(m_summaries.begin());
+		}
+	}
+}
+
+/**
+ * Send the summaries that are not already in flight. Delivery reports
+ * may remove summaries while they are being sent, so they are found
+ * by their ID each time.
+ *
+ * @return	False if not all of the summaries could be sent
+ */
+bool Kafka::sendSummaries()
+{
+	vector<unsigned long> ids;
+	for (auto& summary : m_summaries)
+	{
+		if (!summary.second.inflight)
+			ids.push_back(summary.first);
+	}
+	for (unsigned int i = 0; i < ids.size(); i++)
+	{
+		auto it = m_summaries.find(ids[i]);
+		if (it == m_summaries.end())
+		{
+			continue;
+		}
+		// Summaries have already been filtered before they were aggregated
+		it->second.inflight = true;
+		ProduceStatus status = sendReading(it->second.reading, NULL, true, ids[i]);
+		if (status == PRODUCE_LIMITED)
+		{
+			Logger::getLogger()->warn("Kafka in-flight data limit reached, %d summaries will be sent later",
+					(int)(ids.size() - i));
+			m_trimmed++;
+		}
+		if (status != PRODUCE_OK)
+		{
+			return false;
+		}
+		rd_kafka_poll(m_rk, 0);
+	}
+	return true;
+}
+
+/**
+ * Record the outcome of sending a summary. A delivered summary is
+ * discarded, one that failed is sent again by the next send.
+ *
+ * @param id		The ID of the summary
+ * @param success	The summary was acknowledged by the broker
+ */
+void Kafka::summaryDelivered(unsigned long id, bool success)
+{
+	auto it = m_summaries.find(id);
+	if (it == m_summaries.end())
+	{
+		// The summary has already been discarded
+		return;
+	}
+	if (success)
+	{
+		delete it->second.reading;
+		m_summaries.erase(it);
+	}
+	else
+	{
+		it->second.inflight = false;
+	}
+}
+
+/**
+ * Serialise a reading as JSON and produce it to the Kafka topic
+ *
+ * @param reading	The reading to send
+ * @param mask		Optional mask of the datapoints to send
+ * @param isReading	False for messages generated by the plugin, these are
+ *			not filtered and not counted as sent
+ * @param summary	The ID of an aggregated summary, these are not counted
+ *			as sent but kept until they are delivered. Summaries
+ *			are sent complete, without report by exception.
+ * @return	Whether the message was produced, left to a later send or failed
+ */
+Kafka::ProduceStatus Kafka::sendReading(Reading *reading, const ProjectionMask *mask, bool isReading,
+		unsigned long summary)
+{
+	if (mask && mask->drop)
+	{
+		// The asset is excluded by the filter rules, count it as sent
+		success();
+		return PRODUCE_OK;
+	}
+	// The payload buffer is reused so that its memory is only allocated once per send
+	string& payload = m_payload;
+	payload.clear();
+	const string& assetName = reading->getAssetName();
+	payload.append("{ \"asset\" : ");
+	quote(payload, assetName);
+	payload.append(", \"timestamp\" : ");
+	quote(payload, reading->getAssetDateUserTime(Reading::FMT_ISO8601MS, true));
+	payload.append(", ");
+	vector<Datapoint *>& datapoints = reading->getReadingData();
+	unsigned long timestamp = reading->getUserTimestamp();
+	bool isPayloadToSend = false;
+	bool isSkipped = false;
+	bool isSuppressed = false;
+	for (auto dit = datapoints.cbegin(); dit != datapoints.cend();
+				++dit)
+	{
+		unsigned int index = dit - datapoints.cbegin();
+		if (mask && !mask->test(index))
+		{
+			isSuppressed = true;
+			continue;
+		}
+		DatapointValue& dpv = (*dit)->getData();
+		DatapointValue::dataTagType dataType = dpv.getType();
+		if ( dataType == DatapointValue::T_IMAGE || dataType == DatapointValue::T_DATABUFFER )
+		{
+			// SKIP Image and databuffer type
+			Logger::getLogger()->info("Image and databuffer are not supported in kafka north implementation. Datapoint %s of asset %s has image/databuffer",(*dit)->getName().c_str(), assetName.c_str());
+			success();
+			isSkipped = true;
+			continue;
+		}
+		// Report by exception, drop datapoints that are within the deadband
+		if (m_deadband && isReading && !summary && !m_deadband->report(assetName, index, *dit, timestamp))
+		{
+			isSuppressed = true;
+			continue;
+		}
+		if (isPayloadToSend)
+		{
+			payload.append(",");
+		}
+		isPayloadToSend = true;
+		quote(payload, (*dit)->getName());
+
+		switch (dpv.getType())
+		{
+			case DatapointValue::T_STRING:
+				{
+				string value = dpv.toStringValue();
+				if (m_objects)
+				{
+					Document d;
+					d.Parse(value.c_str());
+					if (!d.HasParseError())
 					{
-						Document d;
-						d.Parse(value.c_str());
-						if (!d.HasParseError())
-						{
-							payload << " : " << value;
-						}
-						else
-						{
-							payload << " : " << quote(value);
-						}
+						payload.append(" : ").append(value);
 					}
 					else
 					{
-						payload << " : " << quote(value);
+						payload.append(" : ");
+						quote(payload, value);
 					}
+				}
+				else
+				{
+					payload.append(" : ");
+					quote(payload, value);
+				}
+				break;
+				}
+			default:
+				payload.append(" : ");
+				quote(payload, dpv.toString());
+				break;
+		}
+	
+	}
+	payload.append("}");
+	if (isPayloadToSend)
+	{
+		Logger::getLogger()->debug("Kafka payload: '%s'", payload.c_str());
+		// The last values sent are only updated once the message has been delivered
+		DeadbandUpdate *update = (m_deadband && isReading && !summary) ? m_deadband->pending() : NULL;
+		KafkaMessage *message = NULL;
+		if (m_traceLatency || update || !isReading || summary)
+		{
+			message = new KafkaMessage;
+			message->counted = isReading && !summary;
+			message->deadband = update;
+			message->summary = summary;
+			if (m_traceLatency)
+				message->latency = isReading ? m_latency.createRecord(reading) : m_latency.createRecord();
+		}
+		ProduceStatus status = produce(payload, message);
+		if (status != PRODUCE_OK)
+		{
+			if (message)
+				delivered(message, false);
+			if (status == PRODUCE_FAILED)
+				setErrorStatus(true);
+			return status;
+		}
+	}
+	else if (summary)
+	{
+		// Nothing in the summary passed the filter
+		summaryDelivered(summary, true);
+	}
+	else if (isSuppressed && !isSkipped)
+	{
+		// Nothing in the reading passed the filter or deadband, count it as sent
+		success();
+	}
+
+	return PRODUCE_OK;
+}
+
+/**
+ * Send the statistics readings as a single snapshot message containing
+ * the time of the latest reading and a map of the statistic values. The
+ * message is keyed by the service so that a compacted topic keeps the
+ * latest snapshot of each service.
+ *
+ * @param readings	The statistics readings to send
+ * @return	The number of readings sent
+ */
+uint32_t Kafka::sendSnapshot(const vector<Reading *>& readings)
+{
+	Reading *latest = NULL;
+	for (auto reading : readings)
+	{
+		const ProjectionMask *mask = m_projection ? m_projection->getMask(reading) : NULL;
+		if (mask && mask->drop)
+		{
+			continue;
+		}
+		const string& assetName = reading->getAssetName();
+		vector<Datapoint *>& datapoints = reading->getReadingData();
+		for (unsigned int i = 0; i < datapoints.size(); i++)
+		{
+			if (mask && !mask->test(i))
+			{
+				continue;
+			}
+			// Statistics readings normally hold a single datapoint named after the statistic
+			string name = datapoints.size() == 1 ? assetName : assetName + "." + datapoints[i]->getName();
+			string value;
+			DatapointValue& dpv = datapoints[i]->getData();
+			switch (dpv.getType())
+			{
+				case DatapointValue::T_INTEGER:
+				case DatapointValue::T_FLOAT:
+					value = dpv.toString();
 					break;
-					}
+				case DatapointValue::T_STRING:
+					quote(value, dpv.toStringValue());
+					break;
+				case DatapointValue::T_IMAGE:
+				case DatapointValue::T_DATABUFFER:
+					continue;
 				default:
-					payload << " : " << quote(dpv.toString());
+					quote(value, dpv.toString());
 					break;
 			}
-		
+			m_snapshot->set(name, value);
 		}
-		payload << "}";
-		if (isPayloadToSend)
+		if (!latest || reading->getUserTimestamp() > latest->getUserTimestamp())
 		{
-			Logger::getLogger()->debug("Kafka payload: '%s'", payload.str().c_str());
-			if (rd_kafka_produce(m_rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
-				(char *)payload.str().c_str(), payload.str().length(), NULL, 0, NULL) != 0)
-			{
-				setErrorStatus(true);
-				Logger::getLogger()->error("Failed to send data to Kafka: %s", strerror(errno));
-				break;
-			}
+			latest = reading;
 		}
+	}
 
-		rd_kafka_poll(m_rk, 0);
+	map<string, string> values;
+	bool full = m_snapshot->changes(values);
+	if (!latest || (values.empty() && !full))
+	{
+		// Nothing has changed since the last snapshot
+		m_snapshot->commit();
+		return readings.size();
+	}
+
+	string& payload = m_payload;
+	payload.clear();
+	payload.append("{ \"service\" : ");
+	quote(payload, m_snapshotKey);
+	payload.append(", \"timestamp\" : ");
+	quote(payload, latest->getAssetDateUserTime(Reading::FMT_ISO8601MS, true));
+	payload.append(full ? ", \"snapshot\" : \"full\"" : ", \"snapshot\" : \"delta\"");
+	payload.append(", \"values\" : {");
+	bool first = true;
+	for (auto& value : values)
+	{
+		if (!first)
+		{
+			payload.append(",");
+		}
+		first = false;
+		quote(payload, value.first);
+		payload.append(" : ").append(value.second);
+	}
+	payload.append("} }");
+	Logger::getLogger()->debug("Kafka snapshot: '%s'", payload.c_str());
+
+	ProduceStatus status = produce(payload, NULL, &m_snapshotKey);
+	if (status != PRODUCE_OK)
+	{
+		if (status == PRODUCE_LIMITED)
+		{
+			Logger::getLogger()->warn("Kafka in-flight data limit reached, the statistics snapshot will be sent later");
+			m_trimmed++;
+		}
+		else
+		{
+			setErrorStatus(true);
+		}
+		m_snapshot->reset();
+		return 0;
 	}
 	while (rd_kafka_outq_len(m_rk) > 0 && !m_error)
 	{
 		rd_kafka_poll(m_rk, 0);
 		rd_kafka_flush(m_rk, 1000);
 	}
-	Logger::getLogger()->debug("Return with %d messages sent from %d", m_sent, cnt);
-	return m_sent;
+
+	// The snapshot carries all of the readings, they are sent once it is delivered
+	if (m_sent == 0)
+	{
+		m_snapshot->reset();
+		return 0;
+	}
+	m_snapshot->commit();
+	return readings.size();
+}
+
+/**
+ * Produce a message to the Kafka topic. If message compression is
+ * enabled the message is compressed with zstd and the encoding and
+ * dictionary ID are sent as message headers.
+ *
+ * @param message	The message to send
+ * @param opaque	The opaque returned in the delivery report
+ * @param key		Optional key of the message
+ * @return	Whether the message was produced, left to a later send or failed
+ */
+Kafka::ProduceStatus Kafka::produce(const string& message, void *opaque, const string *key)
+{
+	const char	*data = message.data();
+	size_t		length = message.length();
+
+	bool compressed = m_compressor && m_compressor->compress(message, &data, &length);
+	if (!waitForCapacity(length))
+	{
+		return m_error ? PRODUCE_FAILED : PRODUCE_LIMITED;
+	}
+	ProduceStatus status = produceTo(m_clusters[m_active], data, length, compressed, opaque, key, true);
+	if (status != PRODUCE_OK)
+	{
+		return status;
+	}
+	if (m_clusterMode == CLUSTER_FANOUT)
+	{
+		// Only the delivery to the active cluster is tracked and counted. Clusters that are
+		// down or full are skipped rather than holding back the active cluster.
+		for (unsigned int i = 0; i < m_clusters.size(); i++)
+		{
+			if (i == m_active)
+				continue;
+			KafkaCluster *cluster = m_clusters[i];
+			if (!cluster->up || (m_maxInflight && cluster->inflight + (long)length > m_maxInflight)
+					|| produceTo(cluster, data, length, compressed, NULL, key, false) != PRODUCE_OK)
+			{
+				skipped(cluster);
+			}
+		}
+	}
+	return PRODUCE_OK;
+}
+
+/**
+ * Produce a message to the topic of a single cluster. If the queue of
+ * the producer is full and waiting is allowed the delivery reports are
+ * served and the message produced again until the in-flight wait has
+ * elapsed.
+ *
+ * @param cluster	The cluster to send to
+ * @param data		The message to send
+ * @param length	The length of the message
+ * @param compressed	The message has been compressed with zstd
+ * @param opaque	The opaque returned in the delivery report
+ * @param key		Optional key of the message
+ * @param wait		Wait for room in a full queue
+ * @return	Whether the message was produced, left to a later send or failed
+ */
+Kafka::ProduceStatus Kafka::produceTo(KafkaCluster *cluster, const char *data, size_t length, bool compressed,
+		void *opaque, const string *key, bool wait)
+{
+	rd_kafka_resp_err_t err;
+	auto start = chrono::steady_clock::now();
+	while (true)
+	{
+		if (compressed)
+		{
+			char dictionary[16];
+			snprintf(dictionary, sizeof(dictionary), "%u", m_compressor->getDictionaryID());
+			err = rd_kafka_producev(cluster->rk,
+					RD_KAFKA_V_RKT(cluster->rkt),
+					RD_KAFKA_V_PARTITION(RD_KAFKA_PARTITION_UA),
+					RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
+					RD_KAFKA_V_VALUE((void *)data, length),
+					RD_KAFKA_V_KEY(key ? key->data() : NULL, key ? key->length() : 0),
+					RD_KAFKA_V_HEADER("content-encoding", "zstd", -1),
+					RD_KAFKA_V_HEADER("zstd-dictionary", dictionary, -1),
+					RD_KAFKA_V_OPAQUE(opaque),
+					RD_KAFKA_V_END);
+		}
+		else if (rd_kafka_produce(cluster->rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
+				(char *)data, length, key ? key->data() : NULL, key ? key->length() : 0, opaque) != 0)
+		{
+			err = rd_kafka_last_error();
+		}
+		else
+		{
+			err = RD_KAFKA_RESP_ERR_NO_ERROR;
+		}
+		if (err != RD_KAFKA_RESP_ERR__QUEUE_FULL || !wait
+				|| chrono::steady_clock::now() - start >= chrono::milliseconds(INFLIGHT_WAIT))
+		{
+			break;
+		}
+		rd_kafka_poll(cluster->rk, INFLIGHT_POLL);
+	}
+	if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL)
+	{
+		if (wait)
+			Logger::getLogger()->warn("The Kafka queue for %s is full", cluster->brokers.c_str());
+		return PRODUCE_LIMITED;
+	}
+	if (err != RD_KAFKA_RESP_ERR_NO_ERROR)
+	{
+		if (wait)
+			Logger::getLogger()->error("Failed to send data to Kafka %s: %s", cluster->brokers.c_str(), rd_kafka_err2str(err));
+		return PRODUCE_FAILED;
+	}
+	cluster->inflight += length;
+	long inflight = m_inflight += length;
+	if (inflight > m_peakInflight)
+		m_peakInflight = inflight;
+	return PRODUCE_OK;
+}
+
+/**
+ * Select the cluster to send to in failover mode. If the active
+ * cluster is down the next available cluster is used. When sending
+ * to a standby the primary cluster is checked periodically and used
+ * again once it is available.
+ */
+void Kafka::checkClusters()
+{
+	// Only a loss of all brokers fails over, not an error with a single broker or message
+	if (!m_clusters[m_active]->up)
+	{
+		for (unsigned int i = 1; i < m_clusters.size(); i++)
+		{
+			unsigned int index = (m_active + i) % m_clusters.size();
+			if (m_clusters[index]->up)
+			{
+				Logger::getLogger()->warn("Kafka cluster %s is unavailable, failing over to %s",
+						m_clusters[m_active]->brokers.c_str(), m_clusters[index]->brokers.c_str());
+				activate(index);
+				break;
+			}
+		}
+	}
+	if (m_active == 0 || chrono::steady_clock::now() - m_lastHealthCheck < chrono::seconds(m_failbackInterval))
+	{
+		return;
+	}
+	m_lastHealthCheck = chrono::steady_clock::now();
+	const struct rd_kafka_metadata *metadata;
+	KafkaCluster *primary = m_clusters[0];
+	if (rd_kafka_metadata(primary->rk, 0, primary->rkt, &metadata, HEALTH_CHECK_TIMEOUT) == RD_KAFKA_RESP_ERR_NO_ERROR)
+	{
+		rd_kafka_metadata_destroy(metadata);
+		primary->up = true;
+		Logger::getLogger()->info("Kafka cluster %s is available again, failing back from %s",
+				primary->brokers.c_str(), m_clusters[m_active]->brokers.c_str());
+		activate(0);
+	}
+}
+
+/**
+ * Make a cluster the one to which data is sent
+ *
+ * @param index	The index of the cluster
+ */
+void Kafka::activate(unsigned int index)
+{
+	m_active = index;
+	m_rk = m_clusters[index]->rk;
+	m_rkt = m_clusters[index]->rkt;
+	m_error = false;
+}
+
+/**
+ * Count a message that could not be sent to a cluster other than the
+ * active cluster. The count is logged at most once a minute.
+ *
+ * @param cluster	The cluster the message was not sent to
+ */
+void Kafka::skipped(KafkaCluster *cluster)
+{
+	cluster->skipped++;
+	auto now = chrono::steady_clock::now();
+	if (now - cluster->lastSkippedReport < chrono::seconds(SKIPPED_INTERVAL))
+	{
+		return;
+	}
+	Logger::getLogger()->warn("%lu messages could not be sent to the Kafka cluster %s%s",
+			cluster->skipped, cluster->brokers.c_str(), cluster->up ? "" : ", all brokers are down");
+	cluster->skipped = 0;
+	cluster->lastSkippedReport = now;
+}
+
+/**
+ * Wait for the data in-flight to the active cluster to leave room for
+ * a message within the configured limit, serving the delivery reports
+ * while waiting. A message larger than the limit is allowed once
+ * nothing else is in-flight.
+ *
+ * @param length	The length of the message to be produced
+ * @return	False if there is still no room after the wait
+ */
+bool Kafka::waitForCapacity(size_t length)
+{
+	KafkaCluster *active = m_clusters[m_active];
+	if (m_maxInflight == 0 || active->inflight + (long)length <= m_maxInflight)
+	{
+		return true;
+	}
+	auto start = chrono::steady_clock::now();
+	while (active->inflight > 0 && active->inflight + (long)length > m_maxInflight && !m_error)
+	{
+		for (auto cluster : m_clusters)
+			rd_kafka_poll(cluster->rk, cluster->rk == m_rk ? INFLIGHT_POLL : 0);
+		if (chrono::steady_clock::now() - start >= chrono::milliseconds(INFLIGHT_WAIT))
+		{
+			return false;
+		}
+	}
+	return !m_error;
+}
+
+/**
+ * Periodically report the peak memory use of the process and the
+ * peak data in-flight to Kafka
+ */
+void Kafka::reportMemory()
+{
+	if (chrono::steady_clock::now() - m_lastStatistics < chrono::seconds(STATISTICS_INTERVAL))
+	{
+		return;
+	}
+	m_lastStatistics = chrono::steady_clock::now();
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	if (m_maxInflight)
+	{
+		Logger::getLogger()->info("Kafka plugin statistics: peak RSS %ld KB, peak in-flight %ld of %ld bytes, %u sends limited",
+				usage.ru_maxrss, m_peakInflight, m_maxInflight, m_trimmed);
+	}
+	else
+	{
+		Logger::getLogger()->info("Kafka plugin statistics: peak RSS %ld KB, peak in-flight %ld bytes",
+				usage.ru_maxrss, m_peakInflight);
+	}
+	m_peakInflight = m_inflight;
+	m_trimmed = 0;
 }
 
 /**
  * Quote a string, escaping any quote characters appearing in the string
  *
+ * @param rval	The string to append the quoted string to
  * @param orig	The string to quote
- * @return A quoted string
  */
-string Kafka::quote(const string& orig)
+void Kafka::quote(string& rval, const string& orig)
 {
-	string rval("\"");
+	rval += "\"";
 	size_t pos = 0, start = 0;
 
 	if ((pos = orig.find_first_of("\"", start)) != std::string::npos)
@@ -599,6 +2164,5 @@ string Kafka::quote(const string& orig)
 		rval += orig;
 	}
 	rval += "\"";
-	return rval;
 }
 
@@ -0,0 +1,275 @@
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <latency.h>
+#include <logger.h>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+using namespace std;
+
+/**
+ * Return the current time in microseconds since the epoch
+ */
+static uint64_t now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * Clear the histogram
+ */
+void LatencyHistogram::reset()
+{
+	memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+	m_max = 0;
+}
+
+/**
+ * Record a latency in the histogram
+ *
+ * @param value	The latency in microseconds
+ */
+void LatencyHistogram::record(uint64_t value)
+{
+	if (value >= ((uint64_t)1 << MAX_BITS))
+	{
+		value = ((uint64_t)1 << MAX_BITS) - 1;
+	}
+	int index;
+	if (value < (1 << SUB_BITS))
+	{
+		index = (int)value;
+	}
+	else
+	{
+		int exponent = 63 - __builtin_clzll(value);
+		int sub = (value >> (exponent - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+		index = ((exponent - SUB_BITS + 1) << SUB_BITS) + sub;
+	}
+	m_buckets[index]++;
+	m_count++;
+	if (value > m_max)
+	{
+		m_max = value;
+	}
+}
+
+/**
+ * Return the latency below which the given percentage of the
+ * recorded latencies fall
+ *
+ * @param percent	The percentile to return
+ * @return	The latency in microseconds
+ */
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+	if (m_count == 0)
+	{
+		return 0;
+	}
+	uint64_t target = (uint64_t)ceil(m_count * percent / 100.0);
+	if (target == 0)
+	{
+		target = 1;
+	}
+	uint64_t seen = 0;
+	for (int index = 0; index < BUCKETS; index++)
+	{
+		seen += m_buckets[index];
+		if (seen >= target)
+		{
+			if (index < (1 << SUB_BITS))
+			{
+				return index;
+			}
+			// Report the highest value that falls in the bucket
+			int exponent = (index >> SUB_BITS) + SUB_BITS - 1;
+			int sub = index & ((1 << SUB_BITS) - 1);
+			uint64_t width = (uint64_t)1 << (exponent - SUB_BITS);
+			uint64_t upper = ((uint64_t)((1 << SUB_BITS) + sub) << (exponent - SUB_BITS)) + width - 1;
+			return min(upper, m_max);
+		}
+	}
+	return m_max;
+}
+
+/**
+ * Construct the latency tracker
+ */
+LatencyTracker::LatencyTracker() : m_interval(60), m_topN(10), m_assetName("KafkaLatency")
+{
+	m_lastReport = chrono::steady_clock::now();
+}
+
+/**
+ * Set the reporting parameters of the tracker
+ *
+ * @param interval	The reporting interval in seconds
+ * @param topN		The number of slowest assets to report
+ * @param assetName	The asset name of the latency report readings
+ */
+void LatencyTracker::configure(unsigned long interval, unsigned int topN, const string& assetName)
+{
+	lock_guard<mutex> guard(m_mutex);
+	m_interval = interval;
+	m_topN = topN;
+	m_assetName = assetName;
+}
+
+/**
+ * Create the record to attach to the message for a reading
+ *
+ * @param reading	The reading being sent
+ * @return	The record, released by delivered
+ */
+LatencyRecord *LatencyTracker::createRecord(Reading *reading)
+{
+	LatencyRecord *record = new LatencyRecord;
+	struct timeval tv;
+	reading->getUserTimestamp(&tv);
+	record->readingTime = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	record->enqueueTime = now();
+
+	lock_guard<mutex> guard(m_mutex);
+	const string& assetName = reading->getAssetName();
+	auto it = m_ids.find(assetName);
+	if (it == m_ids.end())
+	{
+		record->asset = m_assets.size();
+		m_ids.insert(pair<string, uint32_t>(assetName, record->asset));
+		m_assets.push_back(AssetLatency());
+		m_assets.back().name = assetName;
+	}
+	else
+	{
+		record->asset = it->second;
+	}
+	return record;
+}
+
+/**
+ * Create the record to attach to a message that is not a reading,
+ * such as the latency report itself
+ *
+ * @return	The record, released by delivered
+ */
+LatencyRecord *LatencyTracker::createRecord()
+{
+	LatencyRecord *record = new LatencyRecord;
+	record->readingTime = 0;
+	record->enqueueTime = 0;
+	record->asset = LATENCY_NO_ASSET;
+	return record;
+}
+
+/**
+ * Called from the delivery report of a message to record the latencies
+ * and release the record
+ *
+ * @param record	The record attached to the message
+ * @param success	The message was acknowledged by the broker
+ */
+void LatencyTracker::delivered(LatencyRecord *record, bool success)
+{
+	if (success && record->asset != LATENCY_NO_ASSET)
+	{
+		uint64_t acked = now();
+		uint64_t enqueue = record->enqueueTime > record->readingTime ? record->enqueueTime - record->readingTime : 0;
+		uint64_t ack = acked > record->enqueueTime ? acked - record->enqueueTime : 0;
+
+		lock_guard<mutex> guard(m_mutex);
+		if (record->asset < m_assets.size())
+		{
+			AssetLatency& latency = m_assets[record->asset];
+			latency.enqueue.record(enqueue);
+			latency.ack.record(ack);
+			latency.total.record(enqueue + ack);
+		}
+	}
+	delete record;
+}
+
+/**
+ * Check if the reporting interval has elapsed
+ *
+ * @return	True if a report should be sent
+ */
+bool LatencyTracker::reportDue()
+{
+	lock_guard<mutex> guard(m_mutex);
+	return chrono::steady_clock::now() - m_lastReport >= chrono::seconds(m_interval);
+}
+
+/**
+ * Create the latency report for the slowest assets, ordered by the 99th
+ * percentile of the total latency, and reset the histograms. Each report
+ * reading holds the latencies of one asset in milliseconds.
+ *
+ * @param readings	Vector to which the report readings are appended
+ */
+void LatencyTracker::report(vector<Reading *>& readings)
+{
+	lock_guard<mutex> guard(m_mutex);
+	m_lastReport = chrono::steady_clock::now();
+
+	vector<AssetLatency *> slowest;
+	for (auto& latency : m_assets)
+	{
+		if (latency.total.getCount() > 0)
+		{
+			slowest.push_back(&latency);
+		}
+	}
+	sort(slowest.begin(), slowest.end(), [](const AssetLatency *a, const AssetLatency *b) {
+			return a->total.percentile(99) > b->total.percentile(99);
+		});
+	if (slowest.size() > m_topN)
+	{
+		slowest.resize(m_topN);
+	}
+
+	for (auto latency : slowest)
+	{
+		vector<Datapoint *> datapoints;
+		DatapointValue asset(latency->name);
+		datapoints.push_back(new Datapoint("asset", asset));
+		DatapointValue count((long)latency->total.getCount());
+		datapoints.push_back(new Datapoint("count", count));
+		DatapointValue enqueue50(latency->enqueue.percentile(50) / 1000.0);
+		datapoints.push_back(new Datapoint("enqueue_p50", enqueue50));
+		DatapointValue enqueue99(latency->enqueue.percentile(99) / 1000.0);
+		datapoints.push_back(new Datapoint("enqueue_p99", enqueue99));
+		DatapointValue ack50(latency->ack.percentile(50) / 1000.0);
+		datapoints.push_back(new Datapoint("ack_p50", ack50));
+		DatapointValue ack99(latency->ack.percentile(99) / 1000.0);
+		datapoints.push_back(new Datapoint("ack_p99", ack99));
+		DatapointValue total50(latency->total.percentile(50) / 1000.0);
+		datapoints.push_back(new Datapoint("total_p50", total50));
+		DatapointValue total99(latency->total.percentile(99) / 1000.0);
+		datapoints.push_back(new Datapoint("total_p99", total99));
+		DatapointValue totalMax(latency->total.getMax() / 1000.0);
+		datapoints.push_back(new Datapoint("total_max", totalMax));
+		readings.push_back(new Reading(m_assetName, datapoints));
+
+		Logger::getLogger()->info("Kafka delivery latency of asset %s: p99 %.1f ms, max %.1f ms over %lu messages",
+				latency->name.c_str(), latency->total.percentile(99) / 1000.0,
+				latency->total.getMax() / 1000.0, (unsigned long)latency->total.getCount());
+	}
+
+	for (auto& latency : m_assets)
+	{
+		latency.enqueue.reset();
+		latency.ack.reset();
+		latency.total.reset();
+	}
+}
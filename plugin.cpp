@@ -143,6 +143,216 @@ static const char *default_config = QUOTE({
 		"order": "13",
 		"displayName": "Data Source",
 		"options" : ["readings","statistics"]
+		},
+	"deadband": {
+		"description": "Only send datapoints whose value has changed by more than the deadband since it was last sent",
+		"type": "enumeration",
+		"default": "None",
+		"order": "14",
+		"displayName": "Deadband",
+		"options" : ["None","Absolute","Percent"],
+		"group": "Report By Exception"
+		},
+	"deadbandValue": {
+		"description": "The change in a numeric value, as an absolute value or a percentage of the last value sent, within which the datapoint is not sent",
+		"type": "float",
+		"default": "0",
+		"order": "15",
+		"displayName": "Deadband Value",
+		"validity": "deadband != \"None\"",
+		"group": "Report By Exception"
+		},
+	"heartbeat": {
+		"description": "The maximum time in seconds between sending the value of a datapoint",
+		"type": "integer",
+		"default": "3600",
+		"minimum": "1",
+		"order": "16",
+		"displayName": "Heartbeat Interval",
+		"validity": "deadband != \"None\"",
+		"group": "Report By Exception"
+		},
+	"aggregate": {
+		"description": "Send the minimum, maximum, average and count of each numeric datapoint over a time window rather than the readings",
+		"type": "boolean",
+		"default": "false",
+		"order": "17",
+		"displayName": "Aggregate Readings",
+		"group": "Aggregation"
+		},
+	"aggregateWindow": {
+		"description": "The size of the aggregation window in milliseconds",
+		"type": "integer",
+		"default": "1000",
+		"minimum": "1",
+		"order": "18",
+		"displayName": "Window Size",
+		"validity": "aggregate == \"true\"",
+		"group": "Aggregation"
+		},
+	"filter": {
+		"description": "Rules that select the assets and datapoints to send",
+		"type": "JSON",
+		"default": "{ \"rules\" : [] }",
+		"order": "19",
+		"displayName": "Asset Filter",
+		"group": "Filter"
+		},
+	"traceLatency": {
+		"description": "Measure the delivery latency of the data sent for each asset and periodically send a report of the slowest assets",
+		"type": "boolean",
+		"default": "false",
+		"order": "20",
+		"displayName": "Trace Latency",
+		"group": "Latency"
+		},
+	"latencyInterval": {
+		"description": "The interval in seconds between latency reports",
+		"type": "integer",
+		"default": "60",
+		"minimum": "1",
+		"order": "21",
+		"displayName": "Report Interval",
+		"validity": "traceLatency == \"true\"",
+		"group": "Latency"
+		},
+	"latencyTopN": {
+		"description": "The number of assets with the highest latency to include in each report",
+		"type": "integer",
+		"default": "10",
+		"minimum": "1",
+		"order": "22",
+		"displayName": "Slowest Assets",
+		"validity": "traceLatency == \"true\"",
+		"group": "Latency"
+		},
+	"latencyAsset": {
+		"description": "The asset name of the latency report readings",
+		"type": "string",
+		"default": "KafkaLatency",
+		"order": "23",
+		"displayName": "Report Asset",
+		"validity": "traceLatency == \"true\"",
+		"group": "Latency"
+		},
+	"messageCompression": {
+		"description": "Compress each message individually before it is sent, in addition to any compression codec",
+		"type": "enumeration",
+		"default": "none",
+		"order": "24",
+		"displayName": "Message Compression",
+		"options" : ["none","zstd"],
+		"group": "Message Compression"
+		},
+	"zstdLevel": {
+		"description": "The zstd compression level",
+		"type": "integer",
+		"default": "3",
+		"minimum": "1",
+		"maximum": "19",
+		"order": "25",
+		"displayName": "Compression Level",
+		"validity": "messageCompression == \"zstd\"",
+		"group": "Message Compression"
+		},
+	"zstdDictionary": {
+		"description": "The zstd dictionary file created by the kafka_dictionary tool, leave blank to train a dictionary from the messages sent",
+		"type": "string",
+		"default": "",
+		"order": "26",
+		"displayName": "Dictionary",
+		"validity": "messageCompression == \"zstd\"",
+		"group": "Message Compression"
+		},
+	"zstdTrainSamples": {
+		"description": "The number of messages used to train a dictionary when no dictionary file is given, 0 to compress without a dictionary",
+		"type": "integer",
+		"default": "1000",
+		"minimum": "0",
+		"order": "27",
+		"displayName": "Training Messages",
+		"validity": "messageCompression == \"zstd\"",
+		"group": "Message Compression"
+		},
+	"maxInflight": {
+		"description": "The maximum amount of data in kilobytes that may be waiting to be acknowledged by Kafka, 0 for no limit",
+		"type": "integer",
+		"default": "0",
+		"minimum": "0",
+		"order": "28",
+		"displayName": "In-flight Limit (KB)"
+		},
+	"clusterMode": {
+		"description": "How the additional Kafka clusters are used, either as standbys for the primary cluster or all receiving the same data",
+		"type": "enumeration",
+		"default": "Single",
+		"order": "29",
+		"displayName": "Cluster Mode",
+		"options" : ["Single","Failover","Fan-out"],
+		"group": "Clusters"
+		},
+	"clusters": {
+		"description": "The additional Kafka clusters, each with its own brokers and optionally its own security settings",
+		"type": "JSON",
+		"default": "{ \"clusters\" : [] }",
+		"order": "30",
+		"displayName": "Clusters",
+		"validity": "clusterMode != \"Single\"",
+		"group": "Clusters"
+		},
+	"failbackInterval": {
+		"description": "The interval in seconds at which the primary cluster is checked after a failover",
+		"type": "integer",
+		"default": "30",
+		"minimum": "1",
+		"order": "31",
+		"displayName": "Failback Interval",
+		"validity": "clusterMode != \"Single\"",
+		"group": "Clusters"
+		},
+	"clusterPassword": {
+		"description": "The SASL password of the additional Kafka clusters, if left blank the password of the primary cluster is used",
+		"type": "password",
+		"default": "",
+		"order": "32",
+		"displayName": "Cluster Password",
+		"validity": "clusterMode != \"Single\"",
+		"group": "Clusters"
+		},
+	"clusterSSLPassword": {
+		"description": "The certificate password of the additional Kafka clusters, if left blank the certificate password of the primary cluster is used",
+		"type": "password",
+		"default": "",
+		"order": "33",
+		"displayName": "Cluster Certificate Password",
+		"validity": "clusterMode != \"Single\"",
+		"group": "Clusters"
+		},
+	"snapshotEncoding": {
+		"description": "Send the statistics of each block as a single snapshot message, either complete or with only the statistics that have changed",
+		"type": "enumeration",
+		"default": "None",
+		"order": "34",
+		"displayName": "Statistics Snapshot",
+		"options" : ["None","Full","Delta"],
+		"group": "Statistics"
+		},
+	"snapshotKey": {
+		"description": "The key of the snapshot messages, the service name is used if left blank",
+		"type": "string",
+		"default": "",
+		"order": "35",
+		"displayName": "Snapshot Key",
+		"group": "Statistics"
+		},
+	"snapshotFullInterval": {
+		"description": "The number of snapshots between full snapshots when sending deltas",
+		"type": "integer",
+		"default": "10",
+		"minimum": "1",
+		"order": "36",
+		"displayName": "Full Snapshot Interval",
+		"group": "Statistics"
 		}
 	});
 
@@ -212,6 +422,25 @@ PLUGIN_HANDLE plugin_start(PLUGIN_HANDLE handle)
 	kafka->connect();
 	return handle;
 }
+
+/**
+ * Reconfigure the plugin
+ *
+ * Settings that do not affect the connection are applied to the running
+ * producer, connection changes replace the producer in the background.
+ *
+ * @param handle	The plugin handle
+ * @param newConfig	The new configuration for the plugin
+ */
+void plugin_reconfigure(PLUGIN_HANDLE *handle, const string& newConfig)
+{
+Kafka	*kafka = (Kafka *)*handle;
+
+	ConfigCategory *config = new ConfigCategory("new", newConfig);
+	kafka->reconfigure(config);
+	delete config;
+}
+
 /**
  * Send Readings data to historian server
  */
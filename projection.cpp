@@ -0,0 +1,182 @@
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <projection.h>
+#include <logger.h>
+#include <rapidjson/document.h>
+
+using namespace std;
+using namespace rapidjson;
+
+/**
+ * The maximum number of shapes cached for an asset, assets whose
+ * datapoints vary more than this have their masks compiled again
+ */
+#define MAX_SHAPES	64
+
+/**
+ * Construct the projection from the JSON rules in the plugin configuration
+ *
+ *	{ "rules" : [
+ *		{ "asset" : "pump.*", "action" : "include", "datapoints" : [ "flow", "pressure" ] },
+ *		{ "asset" : "debug.*", "action" : "exclude" }
+ *	] }
+ *
+ * Invalid rules are reported and ignored. If any rule includes a whole
+ * asset, only the assets that match a rule are sent.
+ *
+ * @param rules	The JSON rules
+ */
+Projection::Projection(const string& rules) : m_selectAssets(false)
+{
+	Document d;
+	d.Parse(rules.c_str());
+	if (d.HasParseError() || !d.IsObject())
+	{
+		Logger::getLogger()->error("The asset and datapoint filter is not valid JSON, all data will be sent");
+		return;
+	}
+	if (!d.HasMember("rules") || !d["rules"].IsArray())
+	{
+		return;
+	}
+	for (auto& item : d["rules"].GetArray())
+	{
+		if (!item.IsObject() || !item.HasMember("asset") || !item["asset"].IsString())
+		{
+			Logger::getLogger()->error("Filter rules must have an asset pattern, rule ignored");
+			continue;
+		}
+		Rule rule;
+		try {
+			rule.asset = regex(item["asset"].GetString());
+		} catch (exception& e) {
+			Logger::getLogger()->error("Invalid asset pattern '%s' in filter rule, rule ignored",
+					item["asset"].GetString());
+			continue;
+		}
+		rule.include = true;
+		if (item.HasMember("action") && item["action"].IsString())
+		{
+			rule.include = string(item["action"].GetString()).compare("exclude") != 0;
+		}
+		if (item.HasMember("datapoints") && item["datapoints"].IsArray())
+		{
+			for (auto& dp : item["datapoints"].GetArray())
+			{
+				if (dp.IsString())
+					rule.datapoints.insert(dp.GetString());
+			}
+		}
+		if (rule.include && rule.datapoints.empty())
+		{
+			m_selectAssets = true;
+		}
+		m_rules.push_back(rule);
+	}
+}
+
+/**
+ * Return the mask for a reading, compiling it if the shape of the
+ * reading has not been seen before. The mask remains valid until the
+ * next call.
+ *
+ * @param reading	The reading to filter
+ * @return	The mask of datapoints to send
+ */
+const ProjectionMask *Projection::getMask(Reading *reading)
+{
+	deque<ProjectionMask>& masks = m_masks[reading->getAssetName()];
+	vector<Datapoint *>& datapoints = reading->getReadingData();
+	unsigned int size = datapoints.size();
+	uint64_t signature = layout(datapoints);
+	for (auto& mask : masks)
+	{
+		if (mask.size == size && mask.layout == signature)
+			return &mask;
+	}
+	if (masks.size() >= MAX_SHAPES)
+	{
+		masks.pop_front();
+	}
+	masks.push_back(ProjectionMask());
+	compile(reading, masks.back());
+	masks.back().layout = signature;
+	return &masks.back();
+}
+
+/**
+ * Compute a signature of the names and order of the datapoints of a
+ * reading, using the 64 bit FNV-1a hash
+ *
+ * @param datapoints	The datapoints of the reading
+ * @return	The signature of the datapoint layout
+ */
+uint64_t Projection::layout(const vector<Datapoint *>& datapoints)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (auto datapoint : datapoints)
+	{
+		const string& name = datapoint->getName();
+		for (unsigned int i = 0; i < name.size(); i++)
+		{
+			hash ^= (unsigned char)name[i];
+			hash *= 1099511628211ULL;
+		}
+		// Separate the names so that the boundaries between them are part of the signature
+		hash ^= 0xff;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Compile the mask for the shape of a reading using the first rule
+ * that matches the asset name. Assets that match no rule are sent in
+ * full, unless the rules select assets to include.
+ *
+ * @param reading	The reading
+ * @param mask		The mask to populate
+ */
+void Projection::compile(Reading *reading, ProjectionMask& mask)
+{
+	vector<Datapoint *>& datapoints = reading->getReadingData();
+	mask.size = datapoints.size();
+	mask.bits.assign((mask.size + 63) / 64, 0);
+
+	const Rule *match = NULL;
+	for (auto& rule : m_rules)
+	{
+		if (regex_match(reading->getAssetName(), rule.asset))
+		{
+			match = &rule;
+			break;
+		}
+	}
+
+	if (!match)
+	{
+		mask.drop = m_selectAssets;
+	}
+	else if (match->datapoints.empty())
+	{
+		mask.drop = !match->include;
+	}
+	for (unsigned int i = 0; i < mask.size; i++)
+	{
+		bool send = true;
+		if (match && !match->datapoints.empty())
+		{
+			bool listed = match->datapoints.count(datapoints[i]->getName()) > 0;
+			send = match->include ? listed : !listed;
+		}
+		if (send)
+		{
+			mask.bits[i >> 6] |= (uint64_t)1 << (i & 63);
+		}
+	}
+}
@@ -32,12 +32,20 @@ if [[ ( $os_name == *"Red Hat"* || $os_name == *"CentOS"* ) ]]; then
     sudo yum -y install epel-release
     echo "Installing openssl ..."
     sudo yum install -y openssl
+    echo "Installing libzstd-devel ..."
+    sudo yum install -y libzstd-devel
+    echo "Installing lz4-devel and snappy-devel ..."
+    sudo yum install -y lz4-devel snappy-devel
 
 elif apt --version 2>/dev/null; then
     echo "Installing openssl ..."
     sudo apt install -y openssl
     echo "Installing  libssl-dev ..."
     sudo apt install -y  libssl-dev
+    echo "Installing libzstd-dev ..."
+    sudo apt install -y libzstd-dev
+    echo "Installing liblz4-dev and libsnappy-dev ..."
+    sudo apt install -y liblz4-dev libsnappy-dev
 fi
 
 git clone https://github.com/edenhill/librdkafka.git --branch v2.1.1
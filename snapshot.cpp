@@ -0,0 +1,93 @@
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <snapshot.h>
+
+using namespace std;
+
+/**
+ * Construct a statistics snapshot
+ *
+ * @param delta		Send only the statistics that have changed
+ * @param fullInterval	The number of snapshots between full snapshots
+ *			when sending deltas
+ */
+StatisticsSnapshot::StatisticsSnapshot(bool delta, unsigned int fullInterval) :
+	m_delta(delta), m_fullInterval(fullInterval ? fullInterval : 1), m_count(0)
+{
+}
+
+/**
+ * Set the value of a statistic in the current snapshot. If a statistic
+ * is set more than once the last value is used.
+ *
+ * @param name		The name of the statistic
+ * @param value		The value encoded as JSON
+ */
+void StatisticsSnapshot::set(const string& name, const string& value)
+{
+	m_current[name] = value;
+}
+
+/**
+ * Return the statistics to send in the current snapshot. A full snapshot
+ * includes the statistics of earlier snapshots that are not in the
+ * current one, so that the latest message describes every statistic.
+ *
+ * @param values	Map to which the statistics to send are added
+ * @return	True if this is a full snapshot
+ */
+bool StatisticsSnapshot::changes(map<string, string>& values)
+{
+	bool full = !m_delta || m_count % m_fullInterval == 0;
+	if (full)
+	{
+		values = m_previous;
+	}
+	for (auto& value : m_current)
+	{
+		if (full)
+		{
+			values[value.first] = value.second;
+			continue;
+		}
+		auto it = m_previous.find(value.first);
+		if (it == m_previous.end() || it->second.compare(value.second) != 0)
+		{
+			values.insert(value);
+		}
+	}
+	return full;
+}
+
+/**
+ * The current snapshot has been delivered, it becomes the base for
+ * the next delta
+ */
+void StatisticsSnapshot::commit()
+{
+	for (auto& value : m_current)
+	{
+		m_previous[value.first] = value.second;
+	}
+	m_current.clear();
+	m_count++;
+}
+
+/**
+ * The current snapshot could not be delivered, the next snapshot is a
+ * full snapshot
+ */
+void StatisticsSnapshot::reset()
+{
+	for (auto& value : m_current)
+	{
+		m_previous[value.first] = value.second;
+	}
+	m_current.clear();
+	m_count = 0;
+}
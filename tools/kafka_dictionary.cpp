@@ -0,0 +1,318 @@
+/*
+ * Fledge Kafka north plugin.
+ *
+ * Dictionary training and compression benchmark tool
+ *
+ * Copyright (c) 2026 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <zstd.h>
+#include <zdict.h>
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_SNAPPY
+#include <snappy-c.h>
+#endif
+
+using namespace std;
+
+#define DEFAULT_DICTIONARY_SIZE	16384
+#define DEFAULT_LEVEL		3
+#define DEFAULT_MESSAGES	20000
+#define BATCH_SIZE		100
+
+static void usage()
+{
+	fprintf(stderr, "Usage: kafka_dictionary train [-s size] [-o directory] <samples>\n");
+	fprintf(stderr, "       kafka_dictionary bench [-l level] [-d dictionary] [samples]\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Sample files contain one message per line, as consumed from the Kafka topic.\n");
+	fprintf(stderr, "Trained dictionaries are written as kafka-<dictionary ID>.dict, the ID is\n");
+	fprintf(stderr, "carried in the zstd-dictionary header of each message compressed with it.\n");
+	fprintf(stderr, "Without a sample file the benchmark uses generated Fledge readings.\n");
+	exit(1);
+}
+
+/**
+ * Read a file of messages, one per line
+ */
+static bool readSamples(const char *filename, vector<string>& messages)
+{
+	ifstream file(filename);
+	if (!file)
+	{
+		fprintf(stderr, "Unable to open %s\n", filename);
+		return false;
+	}
+	string line;
+	while (getline(file, line))
+	{
+		if (!line.empty())
+			messages.push_back(line);
+	}
+	return true;
+}
+
+/**
+ * Generate messages in the format sent by the plugin for a set of
+ * slowly changing assets
+ */
+static void generateSamples(vector<string>& messages, int count)
+{
+	srand(1);
+	double flow[20], pressure[20], temperature[20];
+	for (int i = 0; i < 20; i++)
+	{
+		flow[i] = 10.0 + i;
+		pressure[i] = 100.0 + i * 3;
+		temperature[i] = 20.0 + i / 2.0;
+	}
+	for (int n = 0; n < count; n++)
+	{
+		int asset = n % 20;
+		int ms = n * 50;
+		flow[asset] += (rand() % 200 - 100) / 1000.0;
+		pressure[asset] += (rand() % 200 - 100) / 500.0;
+		temperature[asset] += (rand() % 20 - 10) / 1000.0;
+		char buf[512];
+		snprintf(buf, sizeof(buf), "{ \"asset\" : \"pump%d\", \"timestamp\" : \"2026-10-18 %02d:%02d:%02d.%03d+00:00\", "
+				"\"flow\" : \"%.6f\",\"pressure\" : \"%.6f\",\"temperature\" : \"%.6f\",\"status\" : \"%s\"}",
+				asset, (ms / 3600000) % 24, (ms / 60000) % 60, (ms / 1000) % 60, ms % 1000,
+				flow[asset], pressure[asset], temperature[asset], rand() % 100 ? "running" : "alarm");
+		messages.push_back(buf);
+	}
+}
+
+/**
+ * Train a dictionary from a set of messages
+ */
+static bool trainDictionary(const vector<string>& messages, size_t capacity, string& dictionary)
+{
+	string samples;
+	vector<size_t> sizes;
+	for (auto& message : messages)
+	{
+		samples.append(message);
+		sizes.push_back(message.size());
+	}
+	dictionary.resize(capacity);
+	size_t size = ZDICT_trainFromBuffer(&dictionary[0], capacity, samples.data(), sizes.data(), sizes.size());
+	if (ZDICT_isError(size))
+	{
+		fprintf(stderr, "Dictionary training failed: %s\n", ZDICT_getErrorName(size));
+		return false;
+	}
+	dictionary.resize(size);
+	return true;
+}
+
+static int train(int argc, char *argv[])
+{
+	size_t capacity = DEFAULT_DICTIONARY_SIZE;
+	string directory = ".";
+	const char *samplesFile = NULL;
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			capacity = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			directory = argv[++i];
+		else
+			samplesFile = argv[i];
+	}
+	if (!samplesFile)
+		usage();
+
+	vector<string> messages;
+	if (!readSamples(samplesFile, messages))
+		return 1;
+	string dictionary;
+	if (!trainDictionary(messages, capacity, dictionary))
+		return 1;
+
+	unsigned int id = ZDICT_getDictID(dictionary.data(), dictionary.size());
+	ostringstream path;
+	path << directory << "/kafka-" << id << ".dict";
+	ofstream file(path.str().c_str(), ios::binary);
+	if (!file.write(dictionary.data(), dictionary.size()))
+	{
+		fprintf(stderr, "Unable to write %s\n", path.str().c_str());
+		return 1;
+	}
+	printf("Trained dictionary %u of %lu bytes from %lu messages, written to %s\n", id,
+			(unsigned long)dictionary.size(), (unsigned long)messages.size(), path.str().c_str());
+	return 0;
+}
+
+/**
+ * Compress each group of messages with a codec and report the ratio and time
+ */
+static void measure(const char *name, const vector<string>& messages, size_t group,
+		function<size_t(const string&)> codec)
+{
+	size_t raw = 0, compressed = 0;
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < messages.size(); i += group)
+	{
+		string block;
+		for (size_t j = i; j < i + group && j < messages.size(); j++)
+			block.append(messages[j]);
+		raw += block.size();
+		compressed += codec(block);
+	}
+	double us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+	printf("%-28s %10lu %10lu %8.2f %10.2f\n", name, (unsigned long)raw, (unsigned long)compressed,
+			compressed ? (double)raw / compressed : 0.0, us / messages.size());
+}
+
+static size_t gzipCompress(const string& block, int level)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+	vector<unsigned char> out(deflateBound(&zs, block.size()) + 32);
+	zs.next_in = (Bytef *)block.data();
+	zs.avail_in = block.size();
+	zs.next_out = out.data();
+	zs.avail_out = out.size();
+	deflate(&zs, Z_FINISH);
+	size_t size = zs.total_out;
+	deflateEnd(&zs);
+	return size;
+}
+
+#ifdef HAVE_LZ4
+/**
+ * Compress as an lz4 frame, the format Kafka uses for lz4 batches
+ */
+static size_t lz4Compress(const string& block)
+{
+	vector<char> out(LZ4F_compressFrameBound(block.size(), NULL));
+	size_t size = LZ4F_compressFrame(out.data(), out.size(), block.data(), block.size(), NULL);
+	return LZ4F_isError(size) ? 0 : size;
+}
+#endif
+
+#ifdef HAVE_SNAPPY
+static size_t snappyCompress(const string& block)
+{
+	size_t size = snappy_max_compressed_length(block.size());
+	vector<char> out(size);
+	if (snappy_compress(block.data(), block.size(), out.data(), &size) != SNAPPY_OK)
+		return 0;
+	return size;
+}
+#endif
+
+static int bench(int argc, char *argv[])
+{
+	int level = DEFAULT_LEVEL;
+	const char *dictionaryFile = NULL;
+	const char *samplesFile = NULL;
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			level = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			dictionaryFile = argv[++i];
+		else
+			samplesFile = argv[i];
+	}
+
+	vector<string> messages;
+	if (samplesFile)
+	{
+		if (!readSamples(samplesFile, messages))
+			return 1;
+	}
+	else
+	{
+		generateSamples(messages, DEFAULT_MESSAGES);
+	}
+
+	// Without a dictionary file train on the first half and measure the second
+	string dictionary;
+	if (dictionaryFile)
+	{
+		ifstream file(dictionaryFile, ios::binary);
+		if (!file)
+		{
+			fprintf(stderr, "Unable to open %s\n", dictionaryFile);
+			return 1;
+		}
+		dictionary.assign((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	}
+	else
+	{
+		vector<string> training(messages.begin(), messages.begin() + messages.size() / 2);
+		messages.erase(messages.begin(), messages.begin() + messages.size() / 2);
+		if (!trainDictionary(training, DEFAULT_DICTIONARY_SIZE, dictionary))
+			return 1;
+	}
+
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	ZSTD_CDict *cdict = ZSTD_createCDict(dictionary.data(), dictionary.size(), level);
+	vector<char> out;
+	auto zstdPlain = [&](const string& block) -> size_t {
+		out.resize(ZSTD_compressBound(block.size()));
+		return ZSTD_compressCCtx(cctx, out.data(), out.size(), block.data(), block.size(), level);
+	};
+	auto zstdDictionary = [&](const string& block) -> size_t {
+		out.resize(ZSTD_compressBound(block.size()));
+		return ZSTD_compress_usingCDict(cctx, out.data(), out.size(), block.data(), block.size(), cdict);
+	};
+	auto gzip = [](const string& block) -> size_t { return gzipCompress(block, Z_DEFAULT_COMPRESSION); };
+
+	size_t total = 0;
+	for (auto& message : messages)
+		total += message.size();
+	printf("%lu messages, average %lu bytes, dictionary %u of %lu bytes, zstd level %d\n\n",
+			(unsigned long)messages.size(), (unsigned long)(messages.empty() ? 0 : total / messages.size()),
+			ZSTD_getDictID_fromCDict(cdict), (unsigned long)dictionary.size(), level);
+	printf("%-28s %10s %10s %8s %10s\n", "Codec", "Raw", "Compressed", "Ratio", "us/message");
+	measure("gzip per message", messages, 1, gzip);
+#ifdef HAVE_LZ4
+	measure("lz4 per message", messages, 1, lz4Compress);
+#endif
+#ifdef HAVE_SNAPPY
+	measure("snappy per message", messages, 1, snappyCompress);
+#endif
+	measure("zstd per message", messages, 1, zstdPlain);
+	measure("zstd dictionary per message", messages, 1, zstdDictionary);
+	measure("gzip batch of 100", messages, BATCH_SIZE, gzip);
+#ifdef HAVE_LZ4
+	measure("lz4 batch of 100", messages, BATCH_SIZE, lz4Compress);
+#endif
+#ifdef HAVE_SNAPPY
+	measure("snappy batch of 100", messages, BATCH_SIZE, snappyCompress);
+#endif
+	measure("zstd batch of 100", messages, BATCH_SIZE, zstdPlain);
+
+	ZSTD_freeCDict(cdict);
+	ZSTD_freeCCtx(cctx);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+		usage();
+	if (strcmp(argv[1], "train") == 0)
+		return train(argc - 2, argv + 2);
+	if (strcmp(argv[1], "bench") == 0)
+		return bench(argc - 2, argv + 2);
+	usage();
+	return 1;
+}